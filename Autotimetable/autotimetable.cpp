@@ -1,4 +1,5 @@
 #include <cstdint>
+#include <cassert>
 
 #include <utility>
 #include <tuple>
@@ -7,210 +8,1694 @@
 #include <limits>
 #include <iterator>
 #include <type_traits>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <chrono>
+#include <stdexcept>
 
 #include "autotimetable.hpp"
 #include "intrinsics.hpp"
 
-#ifndef AUTOTIMETABLE_FILTER_DEPTH
-#define AUTOTIMETABLE_FILTER_DEPTH 3
+// the number of remaining items (the most constrained ones, which every node moves to the front of the search order) that the lower bound looks at
+// any subset of the remaining items gives a valid bound; looking at more items gives a tighter bound but makes every node slower
+#ifndef AUTOTIMETABLE_BOUND_ITEMS
+#define AUTOTIMETABLE_BOUND_ITEMS 3
+#endif
+
+// when searching with multiple threads, the search tree is split into at least this many subtrees per thread
+// having many more subtrees than threads lets idle threads steal work from busy ones
+#ifndef AUTOTIMETABLE_TASKS_PER_THREAD
+#define AUTOTIMETABLE_TASKS_PER_THREAD 16
+#endif
+
+// the number of nodes a thread searches between checks of the deadline, and of idle threads that it could hand some of its work to
+#ifndef AUTOTIMETABLE_CHECK_INTERVAL
+#define AUTOTIMETABLE_CHECK_INTERVAL 1024
+#endif
+
+// the largest number of rounds of local search done on the greedy timetable that the search starts with
+#ifndef AUTOTIMETABLE_LOCAL_SEARCH_ROUNDS
+#define AUTOTIMETABLE_LOCAL_SEARCH_ROUNDS 4
+#endif
+
+// nodes with fewer remaining items than this are not looked up in or stored into the transposition table, because their subtrees are cheaper to search again than to look up
+#ifndef AUTOTIMETABLE_TRANSPOSITION_MIN_ITEMS
+#define AUTOTIMETABLE_TRANSPOSITION_MIN_ITEMS 3
+#endif
+
+// the transposition table of a search gets this many bytes for every choice of its items (rounded down to a power of two number of buckets, and at most search_config::transposition_table_size)
+// small searches visit few nodes, and would spend longer clearing a large table than searching
+#ifndef AUTOTIMETABLE_TRANSPOSITION_BYTES_PER_CHOICE
+#define AUTOTIMETABLE_TRANSPOSITION_BYTES_PER_CHOICE 2048
+#endif
+
+// define AUTOTIMETABLE_STATS to collect search_stats; otherwise AUTOTIMETABLE_STAT compiles the counting away completely
+#ifdef AUTOTIMETABLE_STATS
+#define AUTOTIMETABLE_STAT(statement) statement
+#else
+#define AUTOTIMETABLE_STAT(statement)
 #endif
 
 namespace autotimetable {
 
-	// moves el towards begin until sequence becomes sorted
-	template <typename RandomAccessIterator, typename Compare>
-	inline RandomAccessIterator sort_single_element_towards_front(RandomAccessIterator begin, RandomAccessIterator el, Compare comp) {
-		while (el > begin && comp(*el, *(el - 1))) {
-			swap(*el, *(el - 1));
-			--el;
-		}
-		return el;
-	}
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+	thread_local std::size_t thread_allocation_count = 0;
+#endif
 
-	// moves el towards end until target
-	template <typename RandomAccessIterator>
-	inline void unsort_single_element_from_front(RandomAccessIterator el, RandomAccessIterator target) {
-		while (el < target) {
-			swap(*el, *(el + 1));
-			++el;
-		}
-	}
+	// the score of the partial timetable being built by the searcher
+	// the penalty of each day is cached, so that adding or removing a choice only needs to rescore the days that the choice touches
+	// (a choice usually touches only one to three days)
+	struct search_state {
+		score_t day_scores[TIMEBLOCK_DAY_COUNT];
+		score_t score;
+		search_state() noexcept : day_scores(), score(0) {}
+	};
 
+	inline void rescore_day(search_state& state, const timeblock& dest, const std::size_t i, const score_config& scorer) noexcept {
+		score_t day_score = calculate_day_score(dest.days[i], scorer);
+		state.score = state.score - state.day_scores[i] + day_score;
+		state.day_scores[i] = day_score;
+	}
 
-	inline score_t calculate_score(const timeblock& timeblock, const score_config& scorer) noexcept {
-		score_t answer = 0;
-		std::for_each(timeblock.days, timeblock.days + TIMEBLOCK_DAY_COUNT, [&answer, &scorer](const timeblock_day_t& day) {
-			if (day != 0) {
-				answer += scorer.travel_penalty;
-				answer += (intrinsics::find_largest_set(day) - intrinsics::find_smallest_set(day) + 1) * scorer.empty_slot_penalty;
-				if (((~day) & scorer.lunch_time) == 0) {
-					answer += scorer.no_lunch_penalty;
-				}
+	// assumes that there are no clashing lessons
+	inline void add_timeblock(search_state& state, timeblock& dest, const timeblock& src, const score_config& scorer) noexcept {
+		for (std::size_t i = 0; i < TIMEBLOCK_DAY_COUNT; ++i) {
+			if (src.days[i] != 0) {
+				dest.days[i] |= src.days[i];
+				rescore_day(state, dest, i, scorer);
 			}
-		});
-		return answer;
+		}
 	}
 
 	// assumes that there are no clashing lessons
-	inline void add_timeblock(score_t& score, timeblock& dest, const timeblock& src, const score_config& scorer) noexcept {
-		// this function is slower than optimal as it recalculates the score
-		// could probably be made faster
-
-		dest.add(src);
-		score = calculate_score(dest, scorer);
+	// this is the exact undo of add_timeblock, and only rescores the days that src touches
+	inline void remove_timeblock(search_state& state, timeblock& dest, const timeblock& src, const score_config& scorer) noexcept {
+		for (std::size_t i = 0; i < TIMEBLOCK_DAY_COUNT; ++i) {
+			if (src.days[i] != 0) {
+				dest.days[i] &= ~src.days[i];
+				rescore_day(state, dest, i, scorer);
+			}
+		}
 	}
 
-	// assumes that there are no clashing lessons
-	inline void remove_timeblock(score_t& score, timeblock& dest, const timeblock& src, const score_config& scorer) noexcept {
-		// this function is slower than optimal as it recalculates the score
-		// could probably be made faster
 
-		dest.remove(src);
-		score = calculate_score(dest, scorer);
-	}
 
+	// the index of a choice amongst the choices of all the items of a search
+	typedef std::uint32_t choice_id_t;
 
+	// an item of a timetable, as returned by the search
+	typedef typename decltype(timetable::items)::value_type timetable_item_t;
+
+	struct search_choice {
+		timeblock slots;
+		typename std::vector<mod_item_choice>::const_iterator choice_it;
+		choice_id_t id; // used to look up the clash bitmaps, and to keep timetables compactly
+		std::uint64_t hash; // the zobrist hash of slots
+	};
 
 	struct search_item {
 		typename std::vector<mod>::const_iterator mod_it;
 		typename std::vector<mod_item>::const_iterator mod_item_it;
-		std::vector<std::pair<timeblock, typename std::vector<mod_item_choice>::const_iterator>> choices;
+		std::vector<search_choice> choices;
+		std::size_t first_id; // the id of choices[0] (the choices of an item have consecutive ids)
+		std::size_t degree; // the total number of choices of other items that the choices of this item clash with, which breaks ties when ordering the items
+		std::size_t index; // the position of this item in the initial search order, which identifies it in every copy of the items
+		std::uint64_t hash; // the zobrist hash of this item being assigned
 	};
 
 	inline void swap(search_item& a, search_item& b) {
 		swap(a.mod_it, b.mod_it);
 		swap(a.mod_item_it, b.mod_item_it);
 		swap(a.choices, b.choices);
+		std::swap(a.first_id, b.first_id);
+		std::swap(a.degree, b.degree);
+		std::swap(a.index, b.index);
+		std::swap(a.hash, b.hash);
 	}
 
 
 	typedef typename std::vector<search_item>::iterator search_iterator_t;
 
 
-	score_t _find_best_impl(const search_iterator_t next, const search_iterator_t end, score_t current_score, timetable& current_timetable, score_t best_score, timetable& best_timetable, const score_config& scorer);
+	// sets of choices are stored as bitsets (arrays of 64-bit words) indexed by search_choice::id
+	typedef std::uint64_t choice_set_word_t;
+
+	constexpr const std::size_t CHOICE_SET_WORD_BITS = 64;
+
+	inline bool choice_set_contains(const choice_set_word_t* set, const std::size_t id) noexcept {
+		return ((set[id / CHOICE_SET_WORD_BITS] >> (id % CHOICE_SET_WORD_BITS)) & 1u) != 0;
+	}
+
+	// the number of live choices of an item
+	typedef std::uint32_t choice_count_t;
+
+	// dest = src with all the choices in removed taken out (dest may be src)
+	// counts holds the number of choices in src of every item (indexed by search_item::index, through items_of_choices, which gives the item of every choice id), and is updated to the counts in dest
+	// this only looks at the choices actually taken out, so keeping the counts costs no more than the difference itself
+	// returns the number of choices taken out
+	inline std::size_t filter_choices(choice_set_word_t* dest, const choice_set_word_t* src, const choice_set_word_t* removed, const std::size_t words, choice_count_t* counts, const std::uint32_t* items_of_choices) noexcept {
+		std::size_t ret = 0;
+		for (std::size_t i = 0; i < words; ++i) {
+			choice_set_word_t taken = src[i] & removed[i];
+			dest[i] = src[i] & ~taken;
+			while (taken != 0) {
+				--counts[items_of_choices[i * CHOICE_SET_WORD_BITS + intrinsics::find_smallest_set(taken)]];
+				taken &= taken - 1;
+				++ret;
+			}
+		}
+		return ret;
+	}
+
+	// returns the index of the first choice of item in [from, to) that is in set, or to if there is none
+	inline std::size_t find_choice(const search_item& item, const choice_set_word_t* set, std::size_t from, const std::size_t to) noexcept {
+		while (from < to) {
+			const std::size_t id = item.first_id + from;
+			const choice_set_word_t word = set[id / CHOICE_SET_WORD_BITS] >> (id % CHOICE_SET_WORD_BITS);
+			if (word != 0)return std::min(from + intrinsics::find_smallest_set(word), to);
+			from += CHOICE_SET_WORD_BITS - id % CHOICE_SET_WORD_BITS;
+		}
+		return to;
+	}
 
-	inline void _do_find_best_iteration(const search_iterator_t& next, const search_iterator_t& end, score_t& current_score, timetable& current_timetable, score_t& best_score, timetable& best_timetable, const score_config& scorer) {
-		search_iterator_t pass_next = next;
-		++pass_next;
+	// the number of choices of item that are in set
+	inline std::size_t count_choices(const search_item& item, const choice_set_word_t* set) noexcept {
+		std::size_t ret = 0;
+		std::size_t id = item.first_id;
+		const std::size_t end_id = item.first_id + item.choices.size();
+		while (id < end_id) {
+			const std::size_t bits = std::min(CHOICE_SET_WORD_BITS - id % CHOICE_SET_WORD_BITS, end_id - id);
+			choice_set_word_t word = set[id / CHOICE_SET_WORD_BITS] >> (id % CHOICE_SET_WORD_BITS);
+			if (bits < CHOICE_SET_WORD_BITS)word &= (choice_set_word_t{ 1 } << bits) - 1;
+			ret += intrinsics::count_set(word);
+			id += bits;
+		}
+		return ret;
+	}
 
-		for (auto it3 = next->choices.cbegin(); it3 != next->choices.cend(); ++it3) {
+	// for every choice, the set of choices (of the other items) that clash with it
+	// this is precomputed once per search, so that forward filtering is a bitset difference instead of a timeblock clash check for every choice
+	struct clash_matrix {
+		std::size_t words; // the number of words in each set
+		std::vector<choice_set_word_t> rows; // row i (the set of choices clashing with choice i) is at rows[i * words]
 
-			if (current_timetable.timeblock.clash(it3->first))continue;
+		inline const choice_set_word_t* row(const std::size_t id) const noexcept {
+			return rows.data() + id * words;
+		}
+	};
 
-			// add the current choice to the current timetable
-			add_timeblock(current_score, current_timetable.timeblock, it3->first, scorer);
-			current_timetable.items.emplace_back(next->mod_it, next->mod_item_it, it3->second);
+	// numbers the choices of all the items, and builds the clash bitmaps
+	// also sets the degree of every item
+	inline clash_matrix build_clash_matrix(std::vector<search_item>& mod_its) {
+		std::size_t choice_count = 0;
+		for (search_item& item : mod_its) {
+			item.first_id = choice_count;
+			for (search_choice& choice : item.choices) {
+				choice.id = static_cast<choice_id_t>(choice_count++);
+			}
+		}
 
-			// recursive call
-			best_score = _find_best_impl(pass_next, end, current_score, current_timetable, best_score, best_timetable, scorer);
+		clash_matrix ret;
+		ret.words = (choice_count + CHOICE_SET_WORD_BITS - 1) / CHOICE_SET_WORD_BITS;
+		ret.rows.resize(choice_count * ret.words);
 
-			// remove the current choice
-			current_timetable.items.pop_back();
-			remove_timeblock(current_score, current_timetable.timeblock, it3->first, scorer);
+		// the slots used by any choice of each item, so that pairs of items that cannot clash at all are skipped without comparing their choices
+		std::vector<timeblock> item_slots(mod_its.size());
+		for (std::size_t i = 0; i < mod_its.size(); ++i) {
+			for (const search_choice& choice : mod_its[i].choices) {
+				item_slots[i].add(choice.slots);
+			}
+		}
 
+		// choices of the same item are never chosen together, so they are not marked as clashing with each other
+		for (auto it1 = mod_its.cbegin(); it1 != mod_its.cend(); ++it1) {
+			for (auto it2 = it1 + 1; it2 != mod_its.cend(); ++it2) {
+				if (!item_slots[it1 - mod_its.cbegin()].clash(item_slots[it2 - mod_its.cbegin()]))continue;
+				for (const search_choice& a : it1->choices) {
+					for (const search_choice& b : it2->choices) {
+						if (a.slots.clash(b.slots)) {
+							ret.rows[a.id * ret.words + b.id / CHOICE_SET_WORD_BITS] |= choice_set_word_t{ 1 } << (b.id % CHOICE_SET_WORD_BITS);
+							ret.rows[b.id * ret.words + a.id / CHOICE_SET_WORD_BITS] |= choice_set_word_t{ 1 } << (a.id % CHOICE_SET_WORD_BITS);
+						}
+					}
+				}
+			}
 		}
+
+		for (search_item& item : mod_its) {
+			item.degree = 0;
+			for (const search_choice& choice : item.choices) {
+				for (std::size_t i = 0; i < ret.words; ++i) {
+					item.degree += intrinsics::count_set(ret.row(choice.id)[i]);
+				}
+			}
+		}
+
+		return ret;
 	}
 
-	
-	// lower score is better
-	// best_timetable is the output, this function will only overwrite it if the score is better than current_best
-	// current_timetable may be modified in this function, but all modifications must be reversed upon returning from this function
-	// return value should be at most best_score (return value == best_score means that nothing better can be found)
-	score_t _find_best_impl(const search_iterator_t next, const search_iterator_t end, score_t current_score, timetable& current_timetable, score_t best_score, timetable& best_timetable, const score_config& scorer) {
-		if (next == end) {
-			if (current_score < best_score) { // we've found something better than ever!
-				// keep this better result instead of the old result
-				best_timetable = current_timetable;
-				best_score = current_score;
+	// the set of all the choices, which is the set of live choices at the root of the search
+	inline std::vector<choice_set_word_t> make_full_choice_set(const std::vector<search_item>& mod_its, const clash_matrix& clashes) {
+		std::vector<choice_set_word_t> ret(clashes.words);
+		for (const search_item& item : mod_its) {
+			for (const search_choice& choice : item.choices) {
+				ret[choice.id / CHOICE_SET_WORD_BITS] |= choice_set_word_t{ 1 } << (choice.id % CHOICE_SET_WORD_BITS);
 			}
-			return best_score;
 		}
-		// note: this optimization can be done because if timetable A is a subset of timetable B, then the penalty for B must be at least equal to the penalty for A
-		if (current_score >= best_score) {
-			return best_score;
+		return ret;
+	}
+
+
+	// the score of the current timetable with the given choice added (assuming that they don't clash)
+	inline score_t score_with(const search_state& current_state, const timeblock& current, const timeblock& added, const score_config& scorer) noexcept {
+		score_t ret = current_state.score;
+		for (std::size_t i = 0; i < TIMEBLOCK_DAY_COUNT; ++i) {
+			if (added.days[i] != 0) {
+				ret += calculate_day_score(current.days[i] | added.days[i], scorer) - current_state.day_scores[i];
+			}
 		}
+		return ret;
+	}
 
-		// if we reach here, it means next < end, i.e. we have some more mod_items to place on the timetable
-		// we will then place the next item on the timetable and recursively call this function again
+	// returns a lower bound on the score of every complete timetable that can be reached from the current partial timetable
+	// only the first AUTOTIMETABLE_BOUND_ITEMS remaining items (which the search has made the most constrained ones) are considered
+	// returns std::numeric_limits<score_t>::max() if one of those items has no choice that does not clash with the current timetable
+	// the smallest marginal score of each remaining item cannot simply be summed, because two items may share the travel and empty slot penalties of the same day
+	// instead, we take the larger of two bounds that are both admissible:
+	// (a) the largest over all remaining items of the smallest score of the current timetable with one choice of that item added
+	// (b) the sum over all days of the largest over all remaining items of the smallest penalty of that day with one choice of that item added
+	// the computation stops early as soon as the bound reaches cutoff, since the caller will prune the subtree anyway
+	inline score_t calculate_lower_bound(const search_iterator_t next, const search_iterator_t end, const search_state& current_state, const timeblock& current, const choice_set_word_t* live, const score_config& scorer, const score_t cutoff) noexcept {
+		score_t item_bound = current_state.score;
+		score_t day_bounds[TIMEBLOCK_DAY_COUNT];
+		std::copy_n(current_state.day_scores, TIMEBLOCK_DAY_COUNT, day_bounds);
+		score_t day_bound = current_state.score;
 
-		if (std::distance(next, end) > (AUTOTIMETABLE_FILTER_DEPTH)) {
-			search_iterator_t filter_it = next;
-			std::advance(filter_it, AUTOTIMETABLE_FILTER_DEPTH);
+		const search_iterator_t bound_end = std::distance(next, end) > (AUTOTIMETABLE_BOUND_ITEMS) ? next + (AUTOTIMETABLE_BOUND_ITEMS) : end;
+		for (search_iterator_t it = next; it != bound_end; ++it) {
+			score_t item_min = std::numeric_limits<score_t>::max();
+			score_t day_mins[TIMEBLOCK_DAY_COUNT];
+			std::fill_n(day_mins, TIMEBLOCK_DAY_COUNT, std::numeric_limits<score_t>::max());
 
-			std::vector<std::pair<timeblock, typename std::vector<mod_item_choice>::const_iterator>> tmp_choices = std::move(filter_it->choices);
+			for (std::size_t i = find_choice(*it, live, 0, it->choices.size()); i != it->choices.size(); i = find_choice(*it, live, i + 1, it->choices.size())) {
+				const search_choice* it3 = &it->choices[i];
+				score_t choice_score = current_state.score;
+				for (std::size_t i = 0; i < TIMEBLOCK_DAY_COUNT; ++i) {
+					if (it3->slots.days[i] == 0) {
+						day_mins[i] = current_state.day_scores[i];
+					}
+					else {
+						score_t day_score = calculate_day_score(current.days[i] | it3->slots.days[i], scorer);
+						choice_score += day_score - current_state.day_scores[i];
+						day_mins[i] = std::min(day_mins[i], day_score);
+					}
+				}
+				item_min = std::min(item_min, choice_score);
+			}
 
-			filter_it->choices.clear();
-			filter_it->choices.reserve(tmp_choices.size());
+			// no choice left for this item, so no complete timetable can be reached
+			if (item_min == std::numeric_limits<score_t>::max())return std::numeric_limits<score_t>::max();
 
-			std::copy_if(tmp_choices.cbegin(), tmp_choices.cend(), std::back_inserter(filter_it->choices), [&current_timetable](const std::pair<timeblock, typename std::vector<mod_item_choice>::const_iterator>& choice) {
-				return !current_timetable.timeblock.clash(choice.first);
-			});
+			item_bound = std::max(item_bound, item_min);
+			for (std::size_t i = 0; i < TIMEBLOCK_DAY_COUNT; ++i) {
+				if (day_mins[i] > day_bounds[i]) {
+					day_bound += day_mins[i] - day_bounds[i];
+					day_bounds[i] = day_mins[i];
+				}
+			}
 
-			//search_iterator_t next_new = next;
-			//++next_new;
-			search_iterator_t new_filter_it = sort_single_element_towards_front(next, filter_it, [](const search_item& a, const search_item& b) {
-				return a.choices.size() < b.choices.size();
-			});
+			if (std::max(item_bound, day_bound) >= cutoff)break;
+		}
 
-			_do_find_best_iteration(next, end, current_score, current_timetable, best_score, best_timetable, scorer);
+		return std::max(item_bound, day_bound);
+	}
 
-			unsort_single_element_from_front(new_filter_it, filter_it);
 
-			filter_it->choices = std::move(tmp_choices);
+	// sets of levels of the search (level i is bit i), used for backjumping
+	// backjumping is only done when there are at most LEVEL_SET_BITS items, so that every level fits
+	typedef std::uint64_t level_set_t;
+
+	constexpr const std::size_t LEVEL_SET_BITS = 64;
+
+	inline level_set_t level_bit(const std::size_t level) noexcept {
+		return level_set_t{ 1 } << level;
+	}
+
+	// the set of levels 0, 1, ..., level - 1
+	inline level_set_t levels_below(const std::size_t level) noexcept {
+		return level >= LEVEL_SET_BITS ? ~level_set_t{ 0 } : level_bit(level) - 1;
+	}
+
+
+	// the subtree below a node depends only on which items have been assigned and on the timeblock they occupy, not on which choices occupy it
+	// so the zobrist hash of a node is the xor of a random key for every assigned item and a random key for every occupied hour
+	// the keys of the hours of a choice are xor-ed together into search_choice::hash, so that assigning a choice updates the hash with two xors
+
+	// the splitmix64 finaliser, which turns consecutive numbers into well mixed keys
+	inline std::uint64_t mix_hash(std::uint64_t x) noexcept {
+		x += 0x9e3779b97f4a7c15u;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+		return x ^ (x >> 31);
+	}
 
+	inline std::uint64_t item_hash(const std::size_t index) noexcept {
+		return mix_hash(static_cast<std::uint64_t>(index) << 16);
+	}
+
+	inline std::uint64_t timeblock_hash(const timeblock& tb) noexcept {
+		std::uint64_t ret = 0;
+		for (std::size_t i = 0; i < TIMEBLOCK_DAY_COUNT; ++i) {
+			std::uint32_t day = tb.days[i];
+			while (day != 0) {
+				const std::uint32_t hour = intrinsics::find_smallest_set(day);
+				day &= day - 1;
+				ret ^= mix_hash((static_cast<std::uint64_t>(i) << 8 | hour) + 1);
+			}
 		}
-		else {
-			_do_find_best_iteration(next, end, current_score, current_timetable, best_score, best_timetable, scorer);
+		return ret;
+	}
+
+	// remembers the nodes whose subtrees have been searched completely, with a lower bound on the score of every complete timetable below them
+	// this is only valid when looking for the single best timetable: since the best score only ever decreases, a subtree that has been searched completely cannot contain a timetable better than the best one found so far, so it never has to be searched again
+	// (when looking for the k best timetables, a subtree reached again with different choices contains different timetables with the same scores, so it has to be searched again)
+	// the table has a fixed number of buckets of two entries, and is shared without locks by all the threads of a search
+	// the first entry of a bucket keeps the node with the most remaining items (the largest subtree), and the second entry is always replaced
+	// an entry stores its key xor-ed with its data, so that an entry torn by two threads writing at once is simply not found
+	// only lower bounds are stored: the search prunes against the best timetable found anywhere so far, so a completed subtree only proves that none of its timetables beats that score, not what its best (exact) score is
+	// finding exact scores would mean searching subtrees without that cutoff, and an upper bound on the best score below a node never lets the search skip it, so neither kind of entry would pay for itself
+	class transposition_table {
+	public:
+		// the number of bytes used by every bucket
+		static constexpr const std::size_t BUCKET_SIZE = 4 * sizeof(std::uint64_t);
+
+		// uses the largest power of two number of buckets that fits into max_bytes (at least one)
+		explicit transposition_table(const std::size_t max_bytes) {
+			std::size_t bucket_count = 1;
+			while (bucket_count * 2 * BUCKET_SIZE <= max_bytes)bucket_count *= 2;
+			entries = std::vector<std::atomic<std::uint64_t>>(bucket_count * 4);
+			mask = bucket_count - 1;
 		}
 
-		// return the new best_score
-		return best_score;
-	}
+		// returns true if the node with the given hash and number of remaining items has been searched completely with a lower bound of at least cutoff
+		inline bool find(const std::uint64_t hash, const std::size_t remaining, const score_t cutoff) const noexcept {
+			const std::atomic<std::uint64_t>* bucket = entries.data() + (hash & mask) * 4;
+			for (std::size_t i = 0; i < 4; i += 2) {
+				const std::uint64_t data = bucket[i + 1].load(std::memory_order_relaxed);
+				if ((bucket[i].load(std::memory_order_relaxed) ^ data) == hash && (data & 0xffffffffu) == remaining && (data >> 32) >= cutoff)return true;
+			}
+			return false;
+		}
 
-	timetable find_best(std::vector<search_item>&& mod_its, const score_config& scorer) {
+		// remembers that the node with the given hash and number of remaining items has been searched completely, and the lower bound of its score
+		inline void store(const std::uint64_t hash, const std::size_t remaining, const score_t lower_bound) noexcept {
+			std::atomic<std::uint64_t>* bucket = entries.data() + (hash & mask) * 4;
+			const std::uint64_t data = static_cast<std::uint64_t>(lower_bound) << 32 | remaining;
+			const std::uint64_t old_data = bucket[1].load(std::memory_order_relaxed);
+			const std::size_t i = ((bucket[0].load(std::memory_order_relaxed) ^ old_data) == hash || (old_data & 0xffffffffu) <= remaining) ? 0 : 2;
+			bucket[i].store(hash ^ data, std::memory_order_relaxed);
+			bucket[i + 1].store(data, std::memory_order_relaxed);
+		}
 
-		// the answer will go here
-		timetable best_timetable;
+	private:
+		std::vector<std::atomic<std::uint64_t>> entries; // every bucket is four words: the key and data of the first entry, then the key and data of the second entry
+		std::uint64_t mask;
+	};
+
+
+	// the k best timetables found so far, shared by all the threads of a search
+	// they are kept in a max-heap by score, so the worst of them (the one to be replaced by the next better timetable) is at the front
+	// score is the score that a timetable must beat to be kept (the score of the worst of the k timetables, or the maximum score if there are fewer than k timetables so far), so it is what the search prunes against
+	// score may be read at any time (it only ever decreases), but best_timetables may only be read after the search has ended
+	struct incumbent {
+		std::atomic<score_t> score;
+		// the timetables are kept as the ids of their choices (one per item), so keeping a better timetable is just a copy of a few integers
+		// they are only turned into timetables (with iterators into the mods) when they are reported or taken
+		std::vector<std::pair<score_t, std::vector<choice_id_t>>> best_timetables;
+		std::vector<timetable_item_t> origins; // the item and choice that every choice id stands for
+		std::size_t k;
+		const std::function<void(const timetable&, score_t)>& on_improvement;
+		std::mutex mutex;
+#ifdef AUTOTIMETABLE_STATS
+		std::size_t improvement_count = 0;
+		std::chrono::steady_clock::time_point first_found = std::chrono::steady_clock::time_point::max(); // when the first timetable was offered
+#endif
+
+		incumbent(const std::size_t k, const std::function<void(const timetable&, score_t)>& on_improvement) : score(std::numeric_limits<score_t>::max()), k(k), on_improvement(on_improvement) {
+			best_timetables.reserve(std::min<std::size_t>(k, 64));
+		}
+
+		// records what the choice ids of the given items stand for; this must be called (after the choices are numbered) before anything is offered
+		inline void index_choices(const std::vector<search_item>& mod_its) {
+			item_count = mod_its.size();
+			for (const search_item& item : mod_its) {
+				for (const search_choice& choice : item.choices) {
+					if (origins.size() <= choice.id)origins.resize(choice.id + 1);
+					origins[choice.id] = timetable_item_t(item.mod_it, item.mod_item_it, choice.choice_it);
+				}
+			}
+		}
+
+		// keeps the given timetable (the ids of the choices of every item) if it is better than the worst of the k best timetables found so far
+		inline void offer(const score_t new_score, const choice_id_t* new_choices) {
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+			// keeping a better timetable (and reporting it) may allocate, but this happens once per improvement rather than once per node, so it isn't counted against the search
+			const std::size_t start_allocation_count = thread_allocation_count;
+#endif
+			std::lock_guard<std::mutex> lock(mutex);
+			if (new_score < score.load(std::memory_order_relaxed)) {
+				if (best_timetables.size() == k) {
+					// reuse the memory of the timetable that got pushed out
+					std::pop_heap(best_timetables.begin(), best_timetables.end(), compare_scores);
+					best_timetables.back().first = new_score;
+					std::copy_n(new_choices, item_count, best_timetables.back().second.begin());
+				}
+				else {
+					best_timetables.emplace_back(new_score, std::vector<choice_id_t>(new_choices, new_choices + item_count));
+				}
+				std::push_heap(best_timetables.begin(), best_timetables.end(), compare_scores);
+				if (best_timetables.size() == k) {
+					score.store(best_timetables.front().first, std::memory_order_relaxed);
+				}
+				AUTOTIMETABLE_STAT(++improvement_count);
+				AUTOTIMETABLE_STAT(if (first_found == std::chrono::steady_clock::time_point::max())first_found = std::chrono::steady_clock::now());
+				if (on_improvement)on_improvement(materialize(new_choices), new_score);
+			}
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+			thread_allocation_count = start_allocation_count;
+#endif
+		}
+
+		// returns the timetables found, best first
+		inline std::vector<timetable> take_timetables() {
+			std::sort_heap(best_timetables.begin(), best_timetables.end(), compare_scores);
+			std::vector<timetable> ret;
+			ret.reserve(best_timetables.size());
+			for (const std::pair<score_t, std::vector<choice_id_t>>& entry : best_timetables) {
+				ret.emplace_back(materialize(entry.second.data()));
+			}
+			best_timetables.clear();
+			return ret;
+		}
+
+	private:
+		std::size_t item_count = 0;
+
+		// the timetable with the given choices, with its items in the order of the choice ids
+		inline timetable materialize(const choice_id_t* choices) const {
+			std::vector<choice_id_t> ids(choices, choices + item_count);
+			std::sort(ids.begin(), ids.end());
+			timetable ret;
+			ret.items.reserve(item_count);
+			for (const choice_id_t id : ids) {
+				ret.items.emplace_back(origins[id]);
+				ret.timeblock.add(std::get<2>(origins[id])->timeblock);
+			}
+			return ret;
+		}
+
+		static inline bool compare_scores(const std::pair<score_t, std::vector<choice_id_t>>& a, const std::pair<score_t, std::vector<choice_id_t>>& b) noexcept {
+			return a.first < b.first;
+		}
+	};
+
+
+	// a partial assignment of choices to items, from which a subtree of the search can be started
+	// items are identified by search_item::index, because every searcher keeps its own copy of the items in its own order
+	struct search_task {
+		std::vector<std::pair<std::size_t, choice_id_t>> prefix; // the item index and the choice id for every item assigned so far
+		timeblock occupied; // the timeblock of the choices in the prefix
+		score_t score; // the score of the choices in the prefix
+	};
+
+
+	// a choice of the item at some level, with the score of the timetable when it is added, for choice_order::cheapest_first
+	struct ordered_choice {
+		score_t score;
+		std::size_t index; // the index of the choice in the choices of the item
+	};
+
+	// one level of the search
+	// this is all the state that the recursive version of the search used to keep on the call stack
+	struct search_frame {
+		const search_choice* choice; // the choice currently made at this level (valid while a deeper level is being searched)
+		// the choices to try are given by positions: with choice_order::stored, a position is an index in the choices of the item; with choice_order::cheapest_first, it is an index in the ordered choices of the level
+		std::size_t cursor; // the position of the next choice to try
+		std::size_t end; // the position past the last choice to try (the choices after it have been handed off to another task)
+		std::size_t swaps[AUTOTIMETABLE_BOUND_ITEMS]; // the positions of the items that were swapped into the positions depth, depth + 1, ... when ordering the items at this level
+		std::size_t swap_count;
+		bool complete; // false if some of the choices at this level (or deeper) have been handed off to another task, so this searcher will not search the whole subtree
+		level_set_t conflicts; // the levels that the failures of the choices tried at this level so far depend on (only kept when backjumping)
+		bool transposable; // whether leave() may remember this node in the transposition table (false for the nodes reached by a forced move, which are never looked up)
+	};
+
+
+	// a depth-first branch and bound search over a copy of the items, using an explicit stack of frames instead of recursion
+	// the search can be suspended (when it runs out of node budget) and resumed, and an unsearched part of it can be handed off as a new task
+	// the stack, the live choice sets and the current timetable are allocated once in the constructor, so the search itself never allocates
+	class searcher {
+	public:
+		// transpositions may be null, which disables the transposition table
+		// when learning nogoods, the searcher adds them to its own copy of the clash bitmaps
+		searcher(std::vector<search_item> items, const clash_matrix& shared_clashes, const std::vector<choice_set_word_t>& all_choices, incumbent& best, transposition_table* transpositions, const search_config& config, const score_config& scorer) :
+			mod_its(std::move(items)), learned_clashes(config.backjump && config.learn_nogoods && mod_its.size() <= LEVEL_SET_BITS ? new clash_matrix(shared_clashes) : nullptr), clashes(learned_clashes ? *learned_clashes : shared_clashes), best(best), transpositions(transpositions),
+			propagate(config.propagate), backjump(config.backjump && mod_its.size() <= LEVEL_SET_BITS), order(config.order), scorer(scorer), frames(mod_its.size() + 1), live_stack((mod_its.size() + 1) * clashes.words), count_stack((mod_its.size() + 1) * mod_its.size()), items_of_choices(all_choices.size() * CHOICE_SET_WORD_BITS),
+			max_choice_count(std::accumulate(mod_its.cbegin(), mod_its.cend(), std::size_t{ 0 }, [](const std::size_t count, const search_item& item) { return std::max(count, item.choices.size()); })),
+			ordered_stack(order == choice_order::cheapest_first ? mod_its.size() * max_choice_count : 0), hash(0), base(0), depth(0), pending_enter(false), done(true), node_count(0), conflict(0) {
+			std::copy(all_choices.cbegin(), all_choices.cend(), live_stack.begin());
+			for (const search_item& item : mod_its) {
+				count_row(0)[item.index] = static_cast<choice_count_t>(count_choices(item, all_choices.data()));
+				for (const search_choice& choice : item.choices) {
+					items_of_choices[choice.id] = static_cast<std::uint32_t>(item.index);
+				}
+			}
+			current_choices.resize(mod_its.size());
+			AUTOTIMETABLE_STAT(stats.nodes_per_depth.resize(mod_its.size() + 1));
+			AUTOTIMETABLE_STAT(stats.bound_prunes_per_depth.resize(mod_its.size() + 1));
+			AUTOTIMETABLE_STAT(stats.filtered_choices_per_depth.resize(mod_its.size() + 1));
+		}
+
+		// prepares to search the subtree below the given task
+		inline void start(const search_task& task) {
+			current_timeblock = timeblock();
+			current_state = search_state();
+			hash = 0;
+
+			for (std::size_t i = 0; i < task.prefix.size(); ++i) {
+				// bring the assigned item to position i, keeping the order of the rest
+				search_iterator_t item_it = std::find_if(mod_its.begin() + i, mod_its.end(), [index = task.prefix[i].first](const search_item& item) {
+					return item.index == index;
+				});
+				std::rotate(mod_its.begin() + i, item_it, item_it + 1);
+				const search_item& item = mod_its[i];
+				const search_choice& choice = item.choices[task.prefix[i].second - item.first_id];
+				frames[i].choice = &choice;
+				apply(i, choice);
+			}
+
+			base = depth = task.prefix.size();
+			pending_enter = true;
+			done = false;
+		}
+
+		// searches until the subtree is done (returns true) or until node_budget nodes have been visited (returns false; call run again to resume)
+		inline bool run(const std::size_t node_budget) {
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+			// everything the search needs is allocated by the constructor and start(), so this loop must not allocate at all
+			const std::size_t start_allocation_count = thread_allocation_count;
+			const bool ret = search_nodes(node_budget);
+			allocation_count += thread_allocation_count - start_allocation_count;
+			assert(thread_allocation_count == start_allocation_count && "the search loop must not allocate");
+			return ret;
+#else
+			return search_nodes(node_budget);
+#endif
+		}
+
+		// the number of nodes visited so far, over all the tasks
+		inline std::size_t nodes() const noexcept {
+			return node_count;
+		}
+
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+		// the number of heap allocations made by run() so far, over all the tasks (not counting keeping better timetables)
+		inline std::size_t allocations() const noexcept {
+			return allocation_count;
+		}
+#endif
+
+#ifdef AUTOTIMETABLE_STATS
+		// what this searcher has done so far, over all the tasks (except for the improvements, which are counted by the incumbent)
+		// only the counts per depth are kept while searching, so the totals are added up here
+		inline const search_stats& statistics() noexcept {
+			stats.bound_prunes = std::accumulate(stats.bound_prunes_per_depth.cbegin(), stats.bound_prunes_per_depth.cend(), std::size_t{ 0 });
+			stats.filtered_choices = std::accumulate(stats.filtered_choices_per_depth.cbegin(), stats.filtered_choices_per_depth.cend(), std::size_t{ 0 });
+			return stats;
+		}
+#endif
+
+		// a lower bound on the score of every complete timetable in the part of the current task that has not been searched yet (the maximum score if the task is done)
+		// this is meant to be called when the search was stopped before finishing the task
+		// every subtree still to be searched is a choice not yet tried at some level, or the node that run() stopped at, and its score bounds every timetable below it
+		inline score_t open_bound() {
+			if (done)return std::numeric_limits<score_t>::max();
+			score_t ret = current_state.score;
+			timeblock above;
+			for (std::size_t d = 0; d < depth; ++d) {
+				if (d >= base) {
+					const choice_set_word_t* live = live_row(d);
+					for (std::size_t position = frames[d].cursor; position < frames[d].end; ++position) {
+						const search_choice& choice = mod_its[d].choices[choice_index(d, position)];
+						if (!choice_set_contains(live, choice.id))continue;
+						timeblock below = above;
+						below.add(choice.slots);
+						ret = std::min(ret, calculate_score(below, scorer));
+					}
+				}
+				above.add(frames[d].choice->slots);
+			}
+			return ret;
+		}
+
+		// hands off the last untried choice of the shallowest level that has one as a new task, and stops this searcher from trying it
+		// levels with only a few items below them are not worth handing off
+		// returns false if there is nothing worth handing off
+		inline bool split(search_task& out) {
+			for (std::size_t d = base; d < depth && d + 2 < mod_its.size(); ++d) {
+				search_frame& frame = frames[d];
+				const search_item& item = mod_its[d];
+				const choice_set_word_t* live = live_row(d);
+				std::size_t i = frame.end;
+				while (i > frame.cursor && !choice_set_contains(live, item.choices[choice_index(d, i - 1)].id))--i;
+				if (i == frame.cursor)continue;
+
+				frame.end = i - 1;
+				const search_choice& choice = item.choices[choice_index(d, i - 1)];
+				for (std::size_t j = base; j <= d; ++j) {
+					frames[j].complete = false;
+				}
+
+				out.prefix.clear();
+				out.occupied = timeblock();
+				for (std::size_t j = 0; j < d; ++j) {
+					out.prefix.emplace_back(mod_its[j].index, frames[j].choice->id);
+					out.occupied.add(frames[j].choice->slots);
+				}
+				out.prefix.emplace_back(item.index, choice.id);
+				out.occupied.add(choice.slots);
+				out.score = calculate_score(out.occupied, scorer);
+				return true;
+			}
+			return false;
+		}
+
+	private:
+		std::vector<search_item> mod_its;
+		std::unique_ptr<clash_matrix> learned_clashes; // the clash bitmaps with the learned nogoods added (null if not learning nogoods)
+		const clash_matrix& clashes;
+		incumbent& best;
+		transposition_table* transpositions;
+		bool propagate; // whether to do full forward checking (see search_config::propagate)
+		bool backjump; // whether to do conflict-directed backjumping (see search_config::backjump)
+		choice_order order; // the order in which the choices of an item are tried (see search_config::order)
+		const score_config& scorer;
+
+		std::vector<search_frame> frames;
+		std::vector<choice_set_word_t> live_stack; // the set of choices that don't clash with the current timetable, for every level
+		std::vector<choice_count_t> count_stack; // the number of live choices of every item (by search_item::index) for every level, used by enter() to order the items
+		std::vector<std::uint32_t> items_of_choices; // the search_item::index of the item of every choice id
+		std::size_t max_choice_count; // the most choices that any item has
+		std::vector<ordered_choice> ordered_stack; // the live choices of the item at every level, cheapest first (only used with choice_order::cheapest_first)
 
 		// the current (temp) timetable being built
-		timetable current_timetable;
+		timeblock current_timeblock;
+		std::vector<choice_id_t> current_choices; // the id of the choice made at every level
+		search_state current_state;
+		std::uint64_t hash; // the zobrist hash of the current timetable
+
+		std::size_t base; // the number of items assigned by the task
+		std::size_t depth; // the number of items assigned so far
+		bool pending_enter; // whether the node at depth has yet to be entered
+		bool done; // whether the current task has been searched completely
+		std::size_t node_count;
+#ifdef AUTOTIMETABLE_STATS
+		search_stats stats;
+#endif
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+		std::size_t allocation_count = 0;
+#endif
+		level_set_t conflict; // the levels that the failure of the last node left depends on (only kept when backjumping)
+
+		inline choice_set_word_t* live_row(const std::size_t level) noexcept {
+			return live_stack.data() + level * clashes.words;
+		}
+
+		// the search loop of run()
+		inline bool search_nodes(std::size_t node_budget) {
+			while (true) {
+				if (pending_enter) {
+					if (node_budget == 0)return false;
+					--node_budget;
+					++node_count;
+					AUTOTIMETABLE_STAT(++stats.nodes_per_depth[depth]);
+					pending_enter = false;
+					if (!enter()) {
+						if (depth == base || (retreat(), !jump_back()))return done = true;
+						continue;
+					}
+				}
+				if (advance()) {
+					pending_enter = true;
+					continue;
+				}
+				if (backjump)conflict = exhausted_conflicts();
+				leave();
+				if (depth == base || (retreat(), !jump_back()))return done = true;
+			}
+		}
+
+		inline choice_count_t* count_row(const std::size_t level) noexcept {
+			return count_stack.data() + level * mod_its.size();
+		}
+
+		inline ordered_choice* ordered_row(const std::size_t level) noexcept {
+			return ordered_stack.data() + level * max_choice_count;
+		}
+
+		// the index in the choices of the item at the given level of the choice at the given position
+		inline std::size_t choice_index(const std::size_t level, const std::size_t position) noexcept {
+			return order == choice_order::cheapest_first ? ordered_row(level)[position].index : position;
+		}
+
+		// adds the given choice (of the item at the given level) to the current timetable
+		inline void apply(const std::size_t level, const search_choice& choice) {
+			add_timeblock(current_state, current_timeblock, choice.slots, scorer);
+			current_choices[level] = choice.id;
+			hash ^= mod_its[level].hash ^ choice.hash;
+
+			// the live choices of the next level are those that don't clash with this choice, and their counts are updated as they are taken out
+			// the rows of the level are left alone, so going back to it (in retreat or jump_back) restores its sets and counts without any work
+			std::copy_n(count_row(level), mod_its.size(), count_row(level + 1));
+			const std::size_t filtered = filter_choices(live_row(level + 1), live_row(level), clashes.row(choice.id), clashes.words, count_row(level + 1), items_of_choices.data());
+			AUTOTIMETABLE_STAT(stats.filtered_choices_per_depth[level] += filtered);
+			static_cast<void>(filtered);
+		}
+
+		// lower score is better
+		// sets up the node at depth, and returns false if there is nothing to search below it (because it is a complete timetable, or because it was pruned)
+		// best will only be overwritten if the score is better than the best score so far
+		inline bool enter() {
+			// other threads may improve the best score at any time, so we use the latest one
+			const score_t best_score = best.score.load(std::memory_order_relaxed);
 
-		// we shall process the module-item with least choices first (it might be faster this way)
+			// a node that fails for any reason other than some item having no choice left depends on every choice made so far
+			conflict = levels_below(depth);
+			if (!promising(best_score))return false;
+
+			// skip the subtree if the same items have been assigned to the same hours before, and that subtree has been searched completely
+			if (transpositions && mod_its.size() - depth >= (AUTOTIMETABLE_TRANSPOSITION_MIN_ITEMS) && transpositions->find(hash, mod_its.size() - depth, best_score)) {
+				return false;
+			}
+
+			if (!placeable())return false;
+
+			// forward checking: an item with only one live choice left must take that choice, so it is assigned straight away, without branching (or looking the node up again)
+			// apply() takes the choices that clash with it out of the live set of the next level, like for any other choice, so a forced move is undone by going back over its level as usual
+			// this is repeated until no remaining item has only one live choice left
+			if (propagate) {
+				bool first = true;
+				for (std::size_t i; (i = find_singleton()) != mod_its.size(); first = false) {
+					force(i, first);
+					conflict = levels_below(depth);
+					if (!promising(best_score) || !placeable())return false;
+				}
+			}
+
+			const search_iterator_t next = mod_its.begin() + depth;
+			const search_iterator_t end = mod_its.end();
+			const choice_set_word_t* live = live_row(depth);
+			const choice_count_t* counts = count_row(depth);
+			const std::size_t remaining = std::distance(next, end);
+			search_frame& frame = frames[depth];
+			frame.transposable = true;
+
+			// fail first: bring the remaining items with the fewest choices that don't clash with the current timetable to the front
+			// these counts were updated by apply() as it took the clashing choices out of the live set, so they are just read here
+			// ties go to the item whose choices clash with the most other choices, since it constrains the rest of the search the most
+			frame.swap_count = std::min<std::size_t>(remaining, AUTOTIMETABLE_BOUND_ITEMS);
+			for (std::size_t j = 0; j < frame.swap_count; ++j) {
+				const std::size_t target = depth + j;
+				std::size_t chosen = target;
+				for (std::size_t i = target + 1; i < mod_its.size(); ++i) {
+					const choice_count_t count = counts[mod_its[i].index], chosen_count = counts[mod_its[chosen].index];
+					if (count < chosen_count || (count == chosen_count && mod_its[i].degree > mod_its[chosen].degree))chosen = i;
+				}
+				frame.swaps[j] = chosen;
+				if (chosen != target)swap(mod_its[target], mod_its[chosen]);
+			}
+
+			// branch and bound: prune the subtree if even the most optimistic completion cannot beat the best timetable found so far
+			// (with only one item left, trying its choices is just as cheap as the bound, so we don't bother)
+			if (remaining > 1 && calculate_lower_bound(next, end, current_state, current_timeblock, live, scorer, best_score) >= best_score) {
+				AUTOTIMETABLE_STAT(++stats.bound_prunes_per_depth[depth]);
+				unorder(frame);
+				return false;
+			}
+
+			// if we reach here, it means next < end, i.e. we have some more mod_items to place on the timetable
+			// we will then try each choice of the next item in turn (in advance), searching deeper after each one
+			frame.cursor = 0;
+			frame.complete = true;
+			frame.conflicts = 0;
+			if (order == choice_order::cheapest_first) {
+				// value ordering: try the choices that add the least to the score first, so that good timetables are found early and prune the rest of the search
+				ordered_choice* ordered = ordered_row(depth);
+				std::size_t count = 0;
+				for (std::size_t i = find_choice(*next, live, 0, next->choices.size()); i != next->choices.size(); i = find_choice(*next, live, i + 1, next->choices.size())) {
+					ordered[count++] = ordered_choice{ score_with(current_state, current_timeblock, next->choices[i].slots, scorer), i };
+				}
+				std::sort(ordered, ordered + count, [](const ordered_choice& a, const ordered_choice& b) {
+					return a.score < b.score || (a.score == b.score && a.index < b.index);
+				});
+				frame.end = count;
+			}
+			else {
+				frame.end = next->choices.size();
+			}
+
+			return true;
+		}
+
+		// returns false if there is nothing to search below the node at depth because it is a complete timetable (which is offered to best), or because it cannot beat best_score
+		inline bool promising(const score_t best_score) {
+			if (depth == mod_its.size()) {
+				AUTOTIMETABLE_STAT(++stats.leaves);
+				if (current_state.score < best_score) { // we've found something better than ever!
+					// keep this better result instead of the old result
+					best.offer(current_state.score, current_choices.data());
+				}
+				return false;
+			}
+			// note: this optimization can be done because if timetable A is a subset of timetable B, then the penalty for B must be at least equal to the penalty for A
+			if (current_state.score >= best_score) {
+				AUTOTIMETABLE_STAT(++stats.bound_prunes_per_depth[depth]);
+				return false;
+			}
+			return true;
+		}
+
+		// returns false if some remaining item has no live choice left, so that no complete timetable can be reached
+		inline bool placeable() {
+			const choice_count_t* counts = count_row(depth);
+			for (std::size_t i = depth; i < mod_its.size(); ++i) {
+				if (counts[mod_its[i].index] == 0) {
+					if (backjump)wiped_out(mod_its[i]);
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// the position of the first remaining item with only one live choice left, or mod_its.size() if there is none
+		inline std::size_t find_singleton() noexcept {
+			const choice_count_t* counts = count_row(depth);
+			for (std::size_t i = depth; i < mod_its.size(); ++i) {
+				if (counts[mod_its[i].index] == 1)return i;
+			}
+			return mod_its.size();
+		}
+
+		// assigns the item at position i, which has only one live choice left, at depth, and goes one level deeper
+		// the level gets a frame with no other choice to try, so the rest of the search goes back over it like over any other level
+		// only the first forced level of a node may be stored in the transposition table, since that is the node that was looked up
+		inline void force(const std::size_t i, const bool first) {
+			search_frame& frame = frames[depth];
+			frame.swap_count = 1;
+			frame.swaps[0] = i;
+			if (i != depth)swap(mod_its[depth], mod_its[i]);
+			const search_item& item = mod_its[depth];
+			frame.choice = &item.choices[find_choice(item, live_row(depth), 0, item.choices.size())];
+			frame.cursor = 0;
+			frame.end = 0;
+			frame.complete = true;
+			frame.conflicts = 0;
+			frame.transposable = first;
+			apply(depth, *frame.choice);
+			++depth;
+		}
+
+		// conflict-directed backjumping:
+		// when an item has no choice left, the failure only depends on the levels whose choices clash with the choices of that item (its culprits)
+		// a level whose choice is not a culprit of the failure of the level below it would fail in the same way with every other choice, so it is skipped (it fails with the same culprits)
+		// otherwise the culprits are added to the conflicts of the level, and when all the choices of the level are done, the level fails with its conflicts as the culprits
+		// only failures where some item has no choice left are traced this way; every other failure (a complete timetable, or pruning by score) depends on all the levels above it, so the search never jumps over a level that could still lead to a better timetable
+
+		// the levels whose choices take out some choice of the given item
+		// these are the levels above the current one whose clash bitmap row meets the choices of item (forced moves are levels too, so this covers what forward checking took out)
+		inline level_set_t culprits(const search_item& item) const noexcept {
+			level_set_t ret = 0;
+			for (std::size_t level = 0; level < depth; ++level) {
+				if (count_choices(item, clashes.row(frames[level].choice->id)) != 0)ret |= level_bit(level);
+			}
+			return ret;
+		}
+
+		// sets conflict for a node where the given item has no choice left, and learns a nogood from it if it involves only one or two choices
+		inline void wiped_out(const search_item& item) {
+			conflict = culprits(item);
+			if (learned_clashes && conflict != 0) {
+				const std::size_t first = intrinsics::find_smallest_set(conflict);
+				const level_set_t rest = conflict & (conflict - 1);
+				if (rest == 0) {
+					// the choice at this level can never be part of a timetable, so we take it out of every level's live choices
+					const std::size_t id = frames[first].choice->id;
+					const choice_set_word_t bit = choice_set_word_t{ 1 } << (id % CHOICE_SET_WORD_BITS);
+					for (std::size_t level = 0; level <= depth; ++level) {
+						choice_set_word_t& word = live_row(level)[id / CHOICE_SET_WORD_BITS];
+						if (word & bit) {
+							word &= ~bit;
+							--count_row(level)[items_of_choices[id]];
+						}
+					}
+				}
+				else if ((rest & (rest - 1)) == 0) {
+					// the choices at these two levels can never be in the same timetable, so we make them clash
+					const std::size_t a = frames[first].choice->id;
+					const std::size_t b = frames[intrinsics::find_smallest_set(rest)].choice->id;
+					learned_clashes->rows[a * learned_clashes->words + b / CHOICE_SET_WORD_BITS] |= choice_set_word_t{ 1 } << (b % CHOICE_SET_WORD_BITS);
+					learned_clashes->rows[b * learned_clashes->words + a / CHOICE_SET_WORD_BITS] |= choice_set_word_t{ 1 } << (a % CHOICE_SET_WORD_BITS);
+				}
+			}
+		}
+
+		// the culprits of the failure of the level at depth, once all of its choices have been tried
+		// these are its conflicts together with the culprits of the choices that were taken out before the level was reached
+		inline level_set_t exhausted_conflicts() const noexcept {
+			const search_frame& frame = frames[depth];
+			if (!frame.complete)return levels_below(depth);
+			return frame.conflicts | culprits(mod_its[depth]);
+		}
+
+		// called after retreating from a failed level, with its culprits in conflict
+		// leaves every level that is not one of the culprits, and returns false if that leaves the whole task
+		inline bool jump_back() {
+			if (!backjump)return true;
+			while ((conflict & level_bit(depth)) == 0 && frames[depth].complete) {
+				leave();
+				if (depth == base)return false;
+				retreat();
+			}
+			frames[depth].conflicts |= conflict & ~level_bit(depth);
+			return true;
+		}
+
+		// undoes the swaps done by enter() to order the items
+		inline void unorder(const search_frame& frame) {
+			for (std::size_t j = frame.swap_count; j-- > 0;) {
+				if (frame.swaps[j] != depth + j)swap(mod_its[depth + j], mod_its[frame.swaps[j]]);
+			}
+		}
+
+		// tries the next choice at depth, and goes one level deeper if there is one
+		inline bool advance() {
+			search_frame& frame = frames[depth];
+			const search_item& item = mod_its[depth];
+			const choice_set_word_t* live = live_row(depth);
+
+			if (order == choice_order::cheapest_first) {
+				const ordered_choice* ordered = ordered_row(depth);
+				const score_t best_score = best.score.load(std::memory_order_relaxed);
+				while (frame.cursor < frame.end) {
+					const ordered_choice& next = ordered[frame.cursor];
+					// the choices are sorted by score, so if this one cannot beat the best timetable, neither can the rest
+					if (next.score >= best_score) {
+						AUTOTIMETABLE_STAT(++stats.bound_prunes_per_depth[depth]);
+						frame.cursor = frame.end;
+						if (backjump)frame.conflicts |= levels_below(depth);
+						return false;
+					}
+					++frame.cursor;
+					// a learned nogood may have taken the choice out since the level was entered
+					if (!choice_set_contains(live, item.choices[next.index].id))continue;
+					frame.choice = &item.choices[next.index];
+					apply(depth, *frame.choice);
+					++depth;
+					return true;
+				}
+				return false;
+			}
+
+			frame.cursor = find_choice(item, live, frame.cursor, frame.end);
+			if (frame.cursor == frame.end)return false;
+
+			frame.choice = &item.choices[frame.cursor++];
+			apply(depth, *frame.choice);
+			++depth;
+			return true;
+		}
+
+		// undoes the ordering done by enter(), after all the choices at depth have been tried
+		inline void leave() {
+			search_frame& frame = frames[depth];
+			unorder(frame);
+
+			// every timetable below this node has either been offered to best or been pruned against a best score at least the current one
+			const std::size_t remaining = mod_its.size() - depth;
+			if (transpositions && frame.complete && frame.transposable && remaining >= (AUTOTIMETABLE_TRANSPOSITION_MIN_ITEMS)) {
+				transpositions->store(hash, remaining, best.score.load(std::memory_order_relaxed));
+			}
+		}
+
+		// goes back one level, removing the choice made there
+		inline void retreat() {
+			--depth;
+			remove_timeblock(current_state, current_timeblock, frames[depth].choice->slots, scorer);
+			hash ^= mod_its[depth].hash ^ frames[depth].choice->hash;
+		}
+	};
+
+
+
+	// the choice of item that doesn't clash with current and gives the lowest score when added to it, or null if every choice clashes
+	inline const search_choice* cheapest_choice(const search_item& item, const search_state& current_state, const timeblock& current, const score_config& scorer) noexcept {
+		const search_choice* ret = nullptr;
+		score_t ret_score = std::numeric_limits<score_t>::max();
+		for (const search_choice& choice : item.choices) {
+			if (current.clash(choice.slots))continue;
+			const score_t choice_score = score_with(current_state, current, choice.slots, scorer);
+			if (choice_score < ret_score) {
+				ret = &choice;
+				ret_score = choice_score;
+			}
+		}
+		return ret;
+	}
+
+	// quickly finds a good timetable and offers it to best, so that the search has a score to prune against from its very first node
+	// the timetable is built greedily (taking the cheapest choice of every item in turn), then improved by local search (changing the choice of one item at a time to its cheapest choice given all the others) until a round makes no improvement
+	// if the greedy timetable gets stuck on an item whose choices all clash, nothing is offered
+	inline void find_initial_timetable(const std::vector<search_item>& mod_its, incumbent& best, const score_config& scorer) {
+		std::vector<const search_choice*> chosen(mod_its.size());
+		search_state current_state;
+		timeblock current;
+		for (std::size_t i = 0; i < mod_its.size(); ++i) {
+			chosen[i] = cheapest_choice(mod_its[i], current_state, current, scorer);
+			if (!chosen[i])return;
+			add_timeblock(current_state, current, chosen[i]->slots, scorer);
+		}
+
+		for (std::size_t round = 0; round < (AUTOTIMETABLE_LOCAL_SEARCH_ROUNDS); ++round) {
+			const score_t old_score = current_state.score;
+			for (std::size_t i = 0; i < mod_its.size(); ++i) {
+				// the current choice does not clash with the others, so there is always a choice to go back to
+				remove_timeblock(current_state, current, chosen[i]->slots, scorer);
+				chosen[i] = cheapest_choice(mod_its[i], current_state, current, scorer);
+				add_timeblock(current_state, current, chosen[i]->slots, scorer);
+			}
+			if (current_state.score == old_score)break;
+		}
+
+		std::vector<choice_id_t> initial(mod_its.size());
+		for (std::size_t i = 0; i < mod_its.size(); ++i) {
+			initial[i] = chosen[i]->id;
+		}
+		best.offer(current_state.score, initial.data());
+	}
+
+
+	// splits the search tree into at least min_tasks subtrees (unless the tree is too small), by expanding the first few items in breadth-first order
+	// subtrees whose prefix already clashes are dropped, and the rest are ordered by the score of their prefix, so that promising subtrees get searched first
+	inline std::vector<search_task> split_search(const std::vector<search_item>& mod_its, const std::size_t min_tasks, const score_config& scorer) {
+		std::vector<search_task> tasks(1);
+		tasks.front().score = 0;
+		for (std::size_t depth = 0; depth < mod_its.size() && tasks.size() < min_tasks; ++depth) {
+			std::vector<search_task> new_tasks;
+			for (const search_task& task : tasks) {
+				for (const search_choice& choice : mod_its[depth].choices) {
+					if (task.occupied.clash(choice.slots))continue;
+					search_task new_task{ task.prefix, task.occupied, 0 };
+					new_task.prefix.emplace_back(mod_its[depth].index, choice.id);
+					new_task.occupied.add(choice.slots);
+					new_task.score = calculate_score(new_task.occupied, scorer);
+					new_tasks.emplace_back(std::move(new_task));
+				}
+			}
+			tasks = std::move(new_tasks);
+		}
+		std::stable_sort(tasks.begin(), tasks.end(), [](const search_task& a, const search_task& b) {
+			return a.score < b.score;
+		});
+		return tasks;
+	}
+
+	// the tasks belonging to one thread of the search
+	// the owning thread takes tasks from the front, and threads that have run out of tasks steal from the back
+	class task_queue {
+		std::deque<search_task> tasks;
+		std::mutex mutex;
+	public:
+		inline void push(search_task&& task) {
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(std::move(task));
+		}
+		inline bool pop(search_task& task) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (tasks.empty())return false;
+			task = std::move(tasks.front());
+			tasks.pop_front();
+			return true;
+		}
+		inline bool steal(search_task& task) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (tasks.empty())return false;
+			task = std::move(tasks.back());
+			tasks.pop_back();
+			return true;
+		}
+		inline bool empty() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return tasks.empty();
+		}
+		// the lowest score of the prefix of any task in the queue (the maximum score if there are none), which bounds the score of every timetable that the tasks could lead to
+		inline score_t min_score() {
+			std::lock_guard<std::mutex> lock(mutex);
+			score_t ret = std::numeric_limits<score_t>::max();
+			for (const search_task& task : tasks) {
+				ret = std::min(ret, task.score);
+			}
+			return ret;
+		}
+	};
+
+	// the state shared by all the threads of a parallel search
+	struct search_pool {
+		std::vector<task_queue> queues;
+		std::atomic<std::size_t> idle_count; // the number of threads that are looking for a task (only changed while holding idle_mutex)
+		std::atomic<bool> stopped; // set when the deadline has passed, to make every thread stop
+		std::chrono::steady_clock::time_point deadline;
+		// idle threads sleep on idle_cv until a task is queued, the search is stopped, or every thread is idle
+		std::mutex idle_mutex;
+		std::condition_variable idle_cv;
+
+		search_pool(const std::size_t thread_count, const std::chrono::steady_clock::time_point deadline) : queues(thread_count), idle_count(0), stopped(false), deadline(deadline) {}
+
+		// wakes the idle threads, after a task has been queued or the search has been stopped
+		// taking the mutex makes sure that a thread that has just failed to take a task is already waiting, so it cannot miss the wakeup
+		inline void wake_idle() {
+			{
+				std::lock_guard<std::mutex> lock(idle_mutex);
+			}
+			idle_cv.notify_all();
+		}
+
+		// takes a task from the given thread's own queue, or steals one from another thread
+		inline bool take(const std::size_t self, search_task& task) {
+			if (queues[self].pop(task))return true;
+			for (std::size_t i = 1; i < queues.size(); ++i) {
+				if (queues[(self + i) % queues.size()].steal(task))return true;
+			}
+			return false;
+		}
+	};
+
+	// runs tasks until every thread has run out of work, or until the deadline
+	// while there are idle threads, a busy thread periodically splits its current subtree and queues the split off part for them to steal
+	inline void search_worker(searcher& searcher, search_pool& pool, const std::size_t self) {
+		search_task task;
+		while (true) {
+			if (!pool.take(self, task)) {
+				// tasks are only ever queued by busy threads, so once every thread is idle there is nothing left to do
+				std::unique_lock<std::mutex> lock(pool.idle_mutex);
+				if (++pool.idle_count == pool.queues.size())pool.idle_cv.notify_all();
+				while (!pool.take(self, task)) {
+					if (pool.idle_count.load() == pool.queues.size() || pool.stopped.load())return;
+					// sleep instead of spinning: a busy thread wakes us when it queues a task or stops the search, and the last thread to become idle wakes the rest
+					pool.idle_cv.wait(lock);
+				}
+				--pool.idle_count;
+			}
+
+			searcher.start(task);
+			while (!searcher.run(AUTOTIMETABLE_CHECK_INTERVAL)) {
+				if (pool.stopped.load(std::memory_order_relaxed))return;
+				if (std::chrono::steady_clock::now() >= pool.deadline) {
+					pool.stopped.store(true);
+					pool.wake_idle();
+					return;
+				}
+				if (pool.idle_count.load(std::memory_order_relaxed) != 0 && pool.queues[self].empty()) {
+					search_task split_task;
+					if (searcher.split(split_task)) {
+						pool.queues[self].push(std::move(split_task));
+						pool.wake_idle();
+					}
+				}
+			}
+		}
+	}
+
+	// how a search went
+	struct search_outcome {
+		bool complete; // whether the search ran to completion (rather than being stopped by the deadline)
+		score_t open_bound; // a lower bound on the score of every timetable in the parts of the search tree that were not searched (the maximum score if complete)
+		std::size_t node_count; // the number of nodes visited, over all the threads
+		search_stats stats; // the counters of all the threads added up (only collected with AUTOTIMETABLE_STATS)
+	};
+
+	// adds the counts per depth of src to those of dest
+	inline void add_per_depth(std::vector<std::size_t>& dest, const std::vector<std::size_t>& src) {
+		if (dest.size() < src.size())dest.resize(src.size());
+		std::transform(src.cbegin(), src.cend(), dest.cbegin(), dest.begin(), std::plus<std::size_t>());
+	}
+
+	// adds the counters of src to dest (the time to the first solution is left alone, since it depends on when each search started)
+	inline void add_stats(search_stats& dest, const search_stats& src) {
+		add_per_depth(dest.nodes_per_depth, src.nodes_per_depth);
+		add_per_depth(dest.bound_prunes_per_depth, src.bound_prunes_per_depth);
+		add_per_depth(dest.filtered_choices_per_depth, src.filtered_choices_per_depth);
+		dest.bound_prunes += src.bound_prunes;
+		dest.filtered_choices += src.filtered_choices;
+		dest.leaves += src.leaves;
+		dest.improvements += src.improvements;
+		dest.search_allocations += src.search_allocations;
+	}
+
+	// searches for the best timetables, putting them into best
+	search_outcome search(std::vector<search_item>&& mod_its, incumbent& best, const score_config& scorer, const search_config& config) {
+
+		// the search reorders the items at every node, but this initial order (least choices first) is the order in which split_search expands them
 		std::sort(mod_its.begin(), mod_its.end(), [](const search_item& a, const search_item& b) {
 			return a.choices.size() < b.choices.size();
 		});
+		for (std::size_t i = 0; i < mod_its.size(); ++i) {
+			mod_its[i].index = i;
+			mod_its[i].hash = item_hash(i);
+		}
+
+
+		// precompute which choices clash with each other
+		const clash_matrix clashes = build_clash_matrix(mod_its);
+		best.index_choices(mod_its);
+
+		// when looking for the k best timetables, the search would find the initial timetable again and keep it twice
+		if (best.k == 1)find_initial_timetable(mod_its, best, scorer);
+		const std::vector<choice_set_word_t> all_choices = make_full_choice_set(mod_its, clashes);
 
-		// lets go!
-		_find_best_impl(mod_its.begin(), mod_its.end(), 0, current_timetable, std::numeric_limits<score_t>::max(), best_timetable, scorer);
+		// every timetable scores at least the bound at the root, which makes the bound reported when the search is stopped early less loose
+		const score_t root_bound = calculate_lower_bound(mod_its.begin(), mod_its.end(), search_state(), timeblock(), all_choices.data(), scorer, std::numeric_limits<score_t>::max());
 
-		return best_timetable;
+		std::size_t thread_count = config.thread_count;
+		if (thread_count == 0)thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+		// the transposition table only works when looking for the single best timetable
+		std::unique_ptr<transposition_table> transpositions;
+		if (best.k == 1 && config.transposition_table_size != 0 && mod_its.size() > (AUTOTIMETABLE_TRANSPOSITION_MIN_ITEMS)) {
+			const std::size_t choice_count = std::accumulate(mod_its.cbegin(), mod_its.cend(), std::size_t{ 0 }, [](const std::size_t count, const search_item& item) {
+				return count + item.choices.size();
+			});
+			transpositions.reset(new transposition_table(std::min(config.transposition_table_size, choice_count * (AUTOTIMETABLE_TRANSPOSITION_BYTES_PER_CHOICE))));
+		}
+
+		if (thread_count == 1) {
+			searcher searcher(std::move(mod_its), clashes, all_choices, best, transpositions.get(), config, scorer);
+
+			// lets go!
+			searcher.start(search_task());
+			bool complete = true;
+			while (!searcher.run(AUTOTIMETABLE_CHECK_INTERVAL)) {
+				if (std::chrono::steady_clock::now() >= config.deadline) {
+					complete = false;
+					break;
+				}
+			}
+			search_outcome ret{ complete, complete ? std::numeric_limits<score_t>::max() : std::max(searcher.open_bound(), root_bound), searcher.nodes(), search_stats() };
+			AUTOTIMETABLE_STAT(add_stats(ret.stats, searcher.statistics()));
+			AUTOTIMETABLE_STAT(ret.stats.improvements = best.improvement_count);
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+			ret.stats.search_allocations = searcher.allocations();
+#endif
+			return ret;
+		}
+		else {
+			search_pool pool(thread_count, config.deadline);
+
+			// deal out the tasks so that every thread starts with some of the most promising ones
+			std::vector<search_task> tasks = split_search(mod_its, thread_count * (AUTOTIMETABLE_TASKS_PER_THREAD), scorer);
+			for (std::size_t i = 0; i < tasks.size(); ++i) {
+				pool.queues[i % thread_count].push(std::move(tasks[i]));
+			}
+
+			// every thread searches with its own copy of the items, because the search reorders and filters them in place
+			std::vector<searcher> searchers;
+			searchers.reserve(thread_count);
+			for (std::size_t i = 0; i < thread_count; ++i) {
+				searchers.emplace_back(mod_its, clashes, all_choices, best, transpositions.get(), config, scorer);
+			}
+
+			// lets go!
+			std::vector<std::thread> threads;
+			threads.reserve(thread_count);
+			for (std::size_t i = 0; i < thread_count; ++i) {
+				threads.emplace_back(search_worker, std::ref(searchers[i]), std::ref(pool), i);
+			}
+			for (std::thread& thread : threads) {
+				thread.join();
+			}
+
+			// the parts of the tree that were not searched are the tasks still queued, and the rest of the tasks that the threads were stopped in
+			search_outcome ret{ !pool.stopped.load(), std::numeric_limits<score_t>::max(), 0, search_stats() };
+			for (std::size_t i = 0; i < thread_count; ++i) {
+				ret.open_bound = std::min({ ret.open_bound, searchers[i].open_bound(), pool.queues[i].min_score() });
+				ret.node_count += searchers[i].nodes();
+				AUTOTIMETABLE_STAT(add_stats(ret.stats, searchers[i].statistics()));
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+				ret.stats.search_allocations += searchers[i].allocations();
+#endif
+			}
+			AUTOTIMETABLE_STAT(ret.stats.improvements = best.improvement_count);
+			if (!ret.complete)ret.open_bound = std::max(ret.open_bound, root_bound);
+			return ret;
+		}
 	}
 
-	timetable find_best(const std::vector<mod>& mods, const score_config& scorer) {
+	// adds a search item for every item of the module
+	void append_search_items(std::vector<search_item>& mod_its, const typename std::vector<mod>::const_iterator it1) {
+		for (auto it2 = it1->items.cbegin(); it2 != it1->items.cend(); ++it2) {
+			std::vector<search_choice> tmp_vec;
+			tmp_vec.reserve(it2->choices.size());
+			for (auto it3 = it2->choices.cbegin(); it3 != it2->choices.cend(); ++it3) {
+				// the if-statement is to prevent mods with many options from making the engine slow by only taking the first of similar options
+				// it turns out that this optimization yields more than 5x increase in speed
+				if (std::find_if(tmp_vec.cbegin(), tmp_vec.cend(), [&tb = it3->timeblock](const search_choice& choice) {
+					return choice.slots == tb;
+				}) == tmp_vec.cend())tmp_vec.push_back(search_choice{ it3->timeblock, it3, 0, timeblock_hash(it3->timeblock) });
+			}
+			tmp_vec.shrink_to_fit();
+			mod_its.emplace_back(search_item{ it1, it2, std::move(tmp_vec), 0, 0, 0, 0 });
+		}
+	}
+
+	std::vector<search_item> make_search_items(const std::vector<mod>& mods) {
 
 		std::vector<search_item> mod_its;
 
 		for (auto it1 = mods.cbegin(); it1 != mods.cend(); ++it1) {
-			for (auto it2 = it1->items.cbegin(); it2 != it1->items.cend(); ++it2) {
-				std::vector<std::pair<timeblock, typename std::vector<mod_item_choice>::const_iterator>> tmp_vec;
-				tmp_vec.reserve(it2->choices.size());
-				for (auto it3 = it2->choices.cbegin(); it3 != it2->choices.cend(); ++it3) {
-					// the if-statement is to prevent mods with many options from making the engine slow by only taking the first of similar options
-					// it turns out that this optimization yields more than 5x increase in speed
-					if (std::find_if(tmp_vec.cbegin(), tmp_vec.cend(), [&tb = it3->timeblock](const std::pair<timeblock, typename std::vector<mod_item_choice>::const_iterator>& choice) {
-						return choice.first == tb;
-					}) == tmp_vec.cend())tmp_vec.emplace_back(it3->timeblock, it3);
-				}
-				tmp_vec.shrink_to_fit();
-				mod_its.emplace_back(search_item{ it1, it2, std::move(tmp_vec) });
-			}
+			append_search_items(mod_its, it1);
 		}
 
 		// be nice to the system, don't keep memory we will never use
 		mod_its.shrink_to_fit();
 
-		return find_best(std::move(mod_its), scorer);
+		return mod_its;
+
+	}
+
+	// removes every choice that occupies a strict superset of the slots of another choice of the same item, and returns the number of choices removed
+	// adding slots to a timetable never lowers its penalty and never removes a clash, so swapping such a choice for the smaller one gives a timetable that is at least as good
+	// this is only valid when looking for the single best timetable, since the removed choices may still be in the k best timetables
+	std::size_t remove_dominated_choices(std::vector<search_item>& mod_its) {
+		std::size_t ret = 0;
+		std::vector<bool> dominated;
+		for (search_item& item : mod_its) {
+			std::vector<search_choice>& choices = item.choices;
+			// choices are distinct (make_search_items removes duplicates), so containing another choice means being a strict superset of it
+			// containment is transitive, so every removed choice contains some choice that is kept
+			dominated.assign(choices.size(), false);
+			for (std::size_t i = 0; i < choices.size(); ++i) {
+				for (std::size_t j = 0; j < choices.size(); ++j) {
+					if (i != j && choices[i].slots.contains(choices[j].slots)) {
+						dominated[i] = true;
+						break;
+					}
+				}
+			}
+			std::size_t new_size = 0;
+			for (std::size_t i = 0; i < choices.size(); ++i) {
+				if (!dominated[i])choices[new_size++] = std::move(choices[i]);
+			}
+			ret += choices.size() - new_size;
+			choices.erase(choices.begin() + new_size, choices.end());
+		}
+		return ret;
+	}
+
+	// splits the items into groups that have no day in common, so that no choice in one group can clash with, or change the penalty of, any choice in another group
+	// (the penalty of a timetable is a sum over the days)
+	// the items are the vertices of a graph with an edge between every two items that have choices on the same day, and the groups are its connected components
+	std::vector<std::vector<search_item>> split_components(std::vector<search_item>&& mod_its) {
+		// union-find, with every item joined to the first item that has a choice on any of its days
+		std::vector<std::size_t> parent(mod_its.size());
+		for (std::size_t i = 0; i < mod_its.size(); ++i) {
+			parent[i] = i;
+		}
+		const auto find_root = [&parent](std::size_t i) {
+			while (parent[i] != i) {
+				parent[i] = parent[parent[i]];
+				i = parent[i];
+			}
+			return i;
+		};
+
+		std::size_t day_items[TIMEBLOCK_DAY_COUNT];
+		std::fill_n(day_items, TIMEBLOCK_DAY_COUNT, mod_its.size());
+		for (std::size_t i = 0; i < mod_its.size(); ++i) {
+			timeblock days_used;
+			for (const search_choice& choice : mod_its[i].choices) {
+				days_used.add(choice.slots);
+			}
+			for (std::size_t j = 0; j < TIMEBLOCK_DAY_COUNT; ++j) {
+				if (days_used.days[j] == 0)continue;
+				if (day_items[j] == mod_its.size()) {
+					day_items[j] = i;
+				}
+				else {
+					parent[find_root(i)] = find_root(day_items[j]);
+				}
+			}
+		}
+
+		std::vector<std::vector<search_item>> ret;
+		std::vector<std::size_t> component_of_root(mod_its.size(), mod_its.size());
+		for (std::size_t i = 0; i < mod_its.size(); ++i) {
+			const std::size_t root = find_root(i);
+			if (component_of_root[root] == mod_its.size()) {
+				component_of_root[root] = ret.size();
+				ret.emplace_back();
+			}
+			ret[component_of_root[root]].emplace_back(std::move(mod_its[i]));
+		}
+		return ret;
+	}
+
+	// finds the best timetable of the items, whose dominated choices have already been removed
+	search_result find_best_items(std::vector<search_item>&& mod_its, const std::size_t dominated_choice_count, const score_config& scorer, const search_config& config) {
+
+		AUTOTIMETABLE_STAT(const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now());
+		search_result ret;
+		ret.dominated_choice_count = dominated_choice_count;
+
+		// every component is searched on its own, and the best timetable is made of the best timetable of every component
+		// searching a few small trees one after another is much cheaper than searching the tree of all the items at once
+		std::vector<std::vector<search_item>> components = split_components(std::move(mod_its));
+		ret.component_count = components.size();
+		ret.optimal = true;
+		ret.best_score = std::numeric_limits<score_t>::max();
+		ret.lower_bound = 0;
+		ret.node_count = 0;
+
+		// the answer will go here
+		timetable& combined = ret.best_timetable;
+		score_t combined_score = 0;
+
+		for (std::size_t i = 0; i < components.size(); ++i) {
+			// a complete timetable only exists while searching the last component, so that is the only time improvements can be reported
+			std::function<void(const timetable&, score_t)> on_improvement;
+			if (config.on_improvement && i + 1 == components.size()) {
+				if (components.size() == 1) {
+					on_improvement = config.on_improvement;
+				}
+				else {
+					on_improvement = [&config, &combined, combined_score](const timetable& part, score_t part_score) {
+						timetable whole = combined;
+						whole.timeblock.add(part.timeblock);
+						whole.items.insert(whole.items.end(), part.items.cbegin(), part.items.cend());
+						config.on_improvement(whole, combined_score + part_score);
+					};
+				}
+			}
+
+			// the time left is shared equally by the components not searched yet, so that the first ones cannot use it all up and leave the others with nothing but their greedy timetables
+			// (a component that finishes early leaves the rest of its share to the ones after it)
+			search_config component_config = config;
+			if (config.deadline != std::chrono::steady_clock::time_point::max()) {
+				const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				if (now < config.deadline)component_config.deadline = now + (config.deadline - now) / static_cast<std::chrono::steady_clock::duration::rep>(components.size() - i);
+			}
+
+			incumbent best(1, on_improvement);
+			const search_outcome outcome = search(std::move(components[i]), best, scorer, component_config);
+			if (!outcome.complete)ret.optimal = false;
+			ret.node_count += outcome.node_count;
+			AUTOTIMETABLE_STAT(add_stats(ret.stats, outcome.stats));
+			// the first complete timetable is the first timetable of the last component
+			AUTOTIMETABLE_STAT(if (i + 1 == components.size() && best.first_found != std::chrono::steady_clock::time_point::max())ret.stats.time_to_first_solution = best.first_found - start_time);
+
+			// the best timetable of this component is either the one found, or in a part of the tree that was not searched
+			// the components don't affect each other's penalties, so their bounds add up (the components not searched are bounded by zero)
+			const score_t part_bound = std::min(best.score.load(), outcome.open_bound);
+			ret.lower_bound = part_bound > std::numeric_limits<score_t>::max() - ret.lower_bound ? std::numeric_limits<score_t>::max() : ret.lower_bound + part_bound;
+
+			std::vector<timetable> best_timetables = best.take_timetables();
+			if (best_timetables.empty()) {
+				// no timetable for this component means no timetable at all (which is only proven if this component was searched completely; otherwise optimal is false and lower_bound is less than the maximum)
+				combined = timetable();
+				return ret;
+			}
+			const timetable& part = best_timetables.front();
+			combined.timeblock.add(part.timeblock);
+			combined.items.insert(combined.items.end(), part.items.cbegin(), part.items.cend());
+			combined_score += calculate_score(part.timeblock, scorer);
+		}
+
+		ret.best_score = combined_score;
+		return ret;
+
+	}
+
+	search_result find_best(const std::vector<mod>& mods, const score_config& scorer, const search_config& config) {
+
+		std::vector<search_item> mod_its = make_search_items(mods);
+		const std::size_t dominated_choice_count = remove_dominated_choices(mod_its);
+		return find_best_items(std::move(mod_its), dominated_choice_count, scorer, config);
+
+	}
+
+	// searches all the items at once for the best timetables, putting them into best, whose size is the k of the result
+	top_k_result search_top_k(std::vector<search_item>&& mod_its, incumbent& best, const score_config& scorer, const search_config& config) {
+		AUTOTIMETABLE_STAT(const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now());
+		search_outcome outcome = search(std::move(mod_its), best, scorer, config);
+		AUTOTIMETABLE_STAT(if (best.first_found != std::chrono::steady_clock::time_point::max())outcome.stats.time_to_first_solution = best.first_found - start_time);
+		// the score of the k-th slot is what the search pruned against, so every timetable that is not kept is no better than it, or lies in a part of the tree that was not searched
+		const score_t lower_bound = std::min(best.score.load(), outcome.open_bound);
+		return top_k_result{ best.take_timetables(), lower_bound, outcome.complete, outcome.node_count, std::move(outcome.stats) };
+	}
+
+	top_k_result find_top_k(const std::vector<mod>& mods, const std::size_t k, const score_config& scorer, const search_config& config) {
+
+		if (k == 0)return top_k_result{ std::vector<timetable>(), 0, true, 0, search_stats() };
+
+		// the answer will go here
+		incumbent best(k, config.on_improvement);
 
+		return search_top_k(make_search_items(mods), best, scorer, config);
+
+	}
+
+	struct engine::prepared {
+		std::vector<mod> mods;
+		std::vector<std::size_t> by_code; // the indices of mods, sorted by code
+		std::vector<std::vector<search_item>> all_items; // the search items of every module
+		std::vector<std::vector<search_item>> best_items; // the search items of every module with the dominated choices removed, for finding the single best timetable
+	};
+
+	engine::engine(std::vector<mod> mods) {
+		std::unique_ptr<prepared> ret(new prepared());
+		ret->mods = std::move(mods);
+		ret->by_code.resize(ret->mods.size());
+		std::iota(ret->by_code.begin(), ret->by_code.end(), std::size_t{ 0 });
+		const std::vector<mod>& all_mods = ret->mods;
+		std::stable_sort(ret->by_code.begin(), ret->by_code.end(), [&all_mods](const std::size_t a, const std::size_t b) {
+			return all_mods[a].code < all_mods[b].code;
+		});
+		ret->all_items.resize(all_mods.size());
+		ret->best_items.resize(all_mods.size());
+		for (std::size_t i = 0; i < all_mods.size(); ++i) {
+			append_search_items(ret->all_items[i], all_mods.cbegin() + i);
+			ret->all_items[i].shrink_to_fit();
+			ret->best_items[i] = ret->all_items[i];
+			remove_dominated_choices(ret->best_items[i]);
+		}
+		data = std::move(ret);
+	}
+
+	engine::~engine() = default;
+
+	const std::vector<mod>& engine::modules() const noexcept {
+		return data->mods;
+	}
+
+	std::size_t engine::find(const std::string& code) const noexcept {
+		const std::vector<mod>& mods = data->mods;
+		auto it = std::lower_bound(data->by_code.cbegin(), data->by_code.cend(), code, [&mods](const std::size_t index, const std::string& code) {
+			return mods[index].code < code;
+		});
+		if (it == data->by_code.cend() || mods[*it].code != code)return mods.size();
+		return *it;
+	}
+
+	// copies the prepared items of the modules (with or without their dominated choices), keeping only the pinned choice of every pinned item
+	// adds the number of dominated choices left out of the items that are not pinned to dominated_choice_count
+	// throws std::invalid_argument if a module index is out of range or given more than once, or a pin is out of range
+	inline std::vector<search_item> make_query_items(const std::vector<mod>& mods, const std::vector<std::vector<search_item>>& all_items, const std::vector<std::vector<search_item>>& best_items, const bool remove_dominated, const std::vector<std::size_t>& module_indices, const std::vector<pin>& pins, std::size_t& dominated_choice_count) {
+		std::vector<search_item> mod_its;
+		std::vector<bool> pinned;
+		std::vector<bool> selected(mods.size(), false);
+		for (const std::size_t module_index : module_indices) {
+			if (module_index >= mods.size())throw std::invalid_argument("Module index out of range.");
+			// the same module twice would have to be placed twice, so no timetable could ever be found
+			if (selected[module_index])throw std::invalid_argument("Module index given more than once.");
+			selected[module_index] = true;
+			const mod& query_mod = mods[module_index];
+			const std::vector<search_item>& items = remove_dominated ? best_items[module_index] : all_items[module_index];
+			mod_its.insert(mod_its.end(), items.cbegin(), items.cend());
+			pinned.assign(items.size(), false);
+			for (const pin& p : pins) {
+				if (p.module_index != module_index)continue;
+				if (p.item_index >= query_mod.items.size() || p.choice_index >= query_mod.items[p.item_index].choices.size())throw std::invalid_argument("Pin out of range.");
+				// the prepared items are in the same order as the items of the module
+				const auto it3 = query_mod.items[p.item_index].choices.cbegin() + p.choice_index;
+				std::vector<search_choice>& choices = mod_its[mod_its.size() - items.size() + p.item_index].choices;
+				choices.clear();
+				choices.emplace_back(search_choice{ it3->timeblock, it3, 0, timeblock_hash(it3->timeblock) });
+				pinned[p.item_index] = true;
+			}
+			for (std::size_t i = 0; i < items.size(); ++i) {
+				if (!pinned[i])dominated_choice_count += all_items[module_index][i].choices.size() - items[i].choices.size();
+			}
+		}
+		return mod_its;
+	}
+
+	search_result engine::solve(const std::vector<std::size_t>& module_indices, const std::vector<pin>& pins, const score_config& scorer, const search_config& config) const {
+		std::size_t dominated_choice_count = 0;
+		std::vector<search_item> mod_its = make_query_items(data->mods, data->all_items, data->best_items, true, module_indices, pins, dominated_choice_count);
+		return find_best_items(std::move(mod_its), dominated_choice_count, scorer, config);
+	}
+
+	top_k_result engine::solve_top_k(const std::vector<std::size_t>& module_indices, const std::vector<pin>& pins, const std::size_t k, const score_config& scorer, const search_config& config) const {
+		if (k == 0)return top_k_result{ std::vector<timetable>(), 0, true, 0, search_stats() };
+		std::size_t dominated_choice_count = 0;
+		std::vector<search_item> mod_its = make_query_items(data->mods, data->all_items, data->best_items, false, module_indices, pins, dominated_choice_count);
+		incumbent best(k, config.on_improvement);
+		return search_top_k(std::move(mod_its), best, scorer, config);
+	}
+
+	std::string to_json(const search_stats& stats) {
+		std::string ret = "{\"nodes_per_depth\":[";
+		for (std::size_t d = 0; d < stats.nodes_per_depth.size(); ++d) {
+			if (d != 0)ret += ',';
+			ret += std::to_string(stats.nodes_per_depth[d]);
+		}
+		ret += "],\"bound_prunes\":" + std::to_string(stats.bound_prunes);
+		ret += ",\"bound_prunes_per_depth\":[";
+		for (std::size_t d = 0; d < stats.bound_prunes_per_depth.size(); ++d) {
+			if (d != 0)ret += ',';
+			ret += std::to_string(stats.bound_prunes_per_depth[d]);
+		}
+		ret += "],\"filtered_choices\":" + std::to_string(stats.filtered_choices);
+		ret += ",\"filtered_choices_per_depth\":[";
+		for (std::size_t d = 0; d < stats.filtered_choices_per_depth.size(); ++d) {
+			if (d != 0)ret += ',';
+			ret += std::to_string(stats.filtered_choices_per_depth[d]);
+		}
+		ret += ']';
+		ret += ",\"leaves\":" + std::to_string(stats.leaves);
+		ret += ",\"improvements\":" + std::to_string(stats.improvements);
+		ret += ",\"time_to_first_solution_us\":";
+		if (stats.time_to_first_solution == std::chrono::steady_clock::duration::max()) {
+			ret += "null";
+		}
+		else {
+			ret += std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(stats.time_to_first_solution).count());
+		}
+		ret += '}';
+		return ret;
 	}
 
 }
\ No newline at end of file
@@ -8,6 +8,10 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <chrono>
+#include <memory>
+
+#include "intrinsics.hpp"
 
 namespace autotimetable {
 
@@ -17,38 +21,48 @@ namespace autotimetable {
 
 	constexpr const std::size_t TIMEBLOCK_DAY_COUNT = 12;
 
+	// the number of days actually stored in a timeblock (the days past TIMEBLOCK_DAY_COUNT are padding, and are always zero)
+	// this is fixed rather than rounded up to the vector width of the build, so that a timeblock (and everything containing one) has the same layout whatever instruction set each translation unit is compiled for
+	constexpr const std::size_t TIMEBLOCK_LANE_COUNT = 16;
+
+	static_assert(TIMEBLOCK_LANE_COUNT >= TIMEBLOCK_DAY_COUNT && TIMEBLOCK_LANE_COUNT % intrinsics::lane_block == 0, "timeblock lanes must hold every day and be a whole number of vector registers");
+
+	static_assert(sizeof(timeblock_day_t) == sizeof(std::uint32_t), "timeblock operations assume 32-bit days");
+
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+	// the number of heap allocations made so far by the calling thread
+	// a program compiled with AUTOTIMETABLE_COUNT_ALLOCATIONS must replace operator new to add to this (as main.cpp does), so that the search can check that it doesn't allocate
+	extern thread_local std::size_t thread_allocation_count;
+#endif
 
 	struct timeblock {
-		timeblock_day_t days[TIMEBLOCK_DAY_COUNT]; // 0-4 = odd week, 5-9 = even week
+		timeblock_day_t days[TIMEBLOCK_LANE_COUNT]; // 0-5 = odd week, 6-11 = even week
 		timeblock() {
-			std::fill_n(days, TIMEBLOCK_DAY_COUNT, 0);
+			std::fill_n(days, TIMEBLOCK_LANE_COUNT, 0);
 		}
 		timeblock(const timeblock&) = default;
 		timeblock(timeblock&&) = default;
 		timeblock& operator=(const timeblock&) = default;
 		timeblock& operator=(timeblock&&) = default;
 		inline void add(const timeblock& other) noexcept {
-			for (std::size_t i = 0; i < TIMEBLOCK_DAY_COUNT; ++i) {
-				days[i] |= other.days[i];
-			}
+			intrinsics::or_lanes<TIMEBLOCK_LANE_COUNT>(days, other.days);
 		}
 		inline void remove(const timeblock& other) noexcept {
-			for (std::size_t i = 0; i < TIMEBLOCK_DAY_COUNT; ++i) {
-				days[i] &= ~other.days[i];
-			}
+			intrinsics::andnot_lanes<TIMEBLOCK_LANE_COUNT>(days, other.days);
 		}
 		inline bool clash(const timeblock& other) const noexcept {
-			for (std::size_t i = 0; i < TIMEBLOCK_DAY_COUNT; ++i) {
-				if ((days[i] & other.days[i]) != 0)return true;
-			}
-			return false;
+			return intrinsics::intersect_lanes<TIMEBLOCK_LANE_COUNT>(days, other.days);
 		}
-		inline bool operator==(const timeblock& other) const noexcept {
-			for (std::size_t i = 0; i < TIMEBLOCK_DAY_COUNT; ++i) {
-				if (days[i] != other.days[i])return false;
+		// whether every slot of other is also in this timeblock
+		inline bool contains(const timeblock& other) const noexcept {
+			for (std::size_t i = 0; i < TIMEBLOCK_LANE_COUNT; ++i) {
+				if ((other.days[i] & ~days[i]) != 0)return false;
 			}
 			return true;
 		}
+		inline bool operator==(const timeblock& other) const noexcept {
+			return intrinsics::equal_lanes<TIMEBLOCK_LANE_COUNT>(days, other.days);
+		}
 
 		inline bool operator!=(const timeblock& other) const noexcept {
 			return !(*this == other);
@@ -100,9 +114,229 @@ namespace autotimetable {
 		return ret;
 	}
 
+	// the order in which the search tries the choices of an item
+	enum class choice_order {
+		stored, // the order of the choices in the mod_item
+		cheapest_first // the choice that adds the least penalty to the timetable so far first (this finds good timetables sooner, which makes the search prune more)
+	};
+
+	struct search_config {
+
+		// the number of threads to search with (0 means one thread per hardware thread)
+		// with more than one thread, the search tree is split into subtrees that the threads share, and the threads prune using each other's best timetables
+		unsigned thread_count;
+
+		// the search stops at this time even if it has not finished, and returns the best timetable found so far
+		std::chrono::steady_clock::time_point deadline;
+
+		// if set, this is called every time a better timetable is found, with the timetable and its penalty
+		// it is called from the searching thread (one call at a time even when there are many threads) while the search waits for it, so it should return quickly
+		std::function<void(const timetable&, score_t)> on_improvement;
+
+		// the largest number of bytes to use for the transposition table, which remembers partial timetables whose completions have all been searched (0 disables it)
+		// the table of a search is sized from its number of choices, up to this size, so small searches don't pay for clearing a large table
+		// every search has its own table, so this is the memory cap per concurrent search
+		// the table is not used when looking for more than one timetable
+		std::size_t transposition_table_size;
+
+		// whether to do full forward checking at every node of the search:
+		// whenever an item is left with only one choice that doesn't clash with the timetable so far, the choices of the other items that clash with it are ruled out too, repeatedly
+		// this makes every node slower, but finds dead ends much earlier, so it helps most with combinations of modules that have few or no valid timetables
+		bool propagate;
+
+		// whether to do conflict-directed backjumping: when the search runs into a dead end (some lesson has no option left that doesn't clash), it goes straight back to the most recent choice that contributed to the clash, instead of trying the other options of choices that had nothing to do with it
+		// this helps with combinations of modules that clash a lot; it is not done for queries with more than 64 items
+		bool backjump;
+
+		// when backjumping, whether to also remember the dead ends that are caused by only one or two choices for the rest of the search
+		bool learn_nogoods;
+
+		// the order in which the choices of an item are tried
+		choice_order order;
+
+	};
+
+	// the deadline for a search that starts at start and may run for time_limit (which must not be negative)
+	// this is the largest time point if the deadline is too far away to be represented, instead of overflowing into the past
+	inline std::chrono::steady_clock::time_point deadline_after(const std::chrono::steady_clock::time_point start, const std::chrono::milliseconds time_limit) noexcept {
+		if (time_limit >= std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::time_point::max() - start))return std::chrono::steady_clock::time_point::max();
+		return start + time_limit;
+	}
+
+	inline search_config default_search_config() {
+		search_config ret;
+		ret.thread_count = 1;
+		ret.deadline = std::chrono::steady_clock::time_point::max();
+		ret.transposition_table_size = std::size_t{ 1 } << 20;
+		ret.propagate = false;
+		ret.backjump = true;
+		ret.learn_nogoods = false;
+		ret.order = choice_order::cheapest_first;
+		return ret;
+	}
+
+	// counters of what a search did, for finding out why some queries take much longer than others
+	// these are only collected if autotimetable.cpp is compiled with AUTOTIMETABLE_STATS defined, because counting slows down every node; otherwise they are all zero
+	struct search_stats {
+
+		// nodes_per_depth[d] is the number of nodes visited with d items assigned
+		std::vector<std::size_t> nodes_per_depth;
+
+		// the number of nodes cut because their score, or the lower bound on the score of every timetable below them, is no better than the best timetable found so far
+		std::size_t bound_prunes;
+
+		// bound_prunes_per_depth[d] is the number of those cuts made with d items assigned
+		std::vector<std::size_t> bound_prunes_per_depth;
+
+		// the number of choices of unassigned items ruled out because they clash with a choice made above them (including those ruled out by forward checking)
+		std::size_t filtered_choices;
+
+		// filtered_choices_per_depth[d] is the number of choices ruled out by the choice made with d items assigned
+		std::vector<std::size_t> filtered_choices_per_depth;
+
+		// the number of complete timetables reached by the search (better or not)
+		std::size_t leaves;
+
+		// the number of times a better timetable was found (including the initial one)
+		std::size_t improvements;
+
+		// the time from the start of the search until the first complete timetable was found (the maximum duration if none was found)
+		std::chrono::steady_clock::duration time_to_first_solution;
+
+		// the number of heap allocations made while searching the nodes, not counting those made to keep a better timetable (which happen once per improvement, not once per node)
+		// this is only counted if autotimetable.cpp is compiled with AUTOTIMETABLE_COUNT_ALLOCATIONS defined (whether or not AUTOTIMETABLE_STATS is), and should always be zero
+		std::size_t search_allocations;
+
+		search_stats() noexcept : bound_prunes(0), filtered_choices(0), leaves(0), improvements(0), time_to_first_solution(std::chrono::steady_clock::duration::max()), search_allocations(0) {}
+
+	};
+
+	// the statistics as a JSON object, with the time in microseconds (null if no timetable was found)
+	std::string to_json(const search_stats& stats);
+
+	struct search_result {
+
+		// the best timetable found (this has no items if there is no valid timetable)
+		timetable best_timetable;
+
+		// the penalty of best_timetable (the maximum score_t if no timetable was found)
+		score_t best_score;
+
+		// no valid timetable has a penalty less than this (the maximum score_t if it is proven that there is no valid timetable)
+		// this equals best_score if the search is optimal; otherwise best_score - lower_bound is how much better than best_timetable the best timetable could still be
+		score_t lower_bound;
+
+		// whether the search ran to completion, which proves that no better timetable exists
+		// this is false only if the search was stopped by the deadline
+		bool optimal;
+
+		// the number of nodes of the search tree visited (over all the threads)
+		std::size_t node_count;
+
+		// the number of choices that were not searched because another choice of the same item occupies a strict subset of their slots
+		std::size_t dominated_choice_count;
+
+		// the number of groups of items that have no day in common, which were searched separately
+		std::size_t component_count;
+
+		// what the search did (only collected if the library is compiled with AUTOTIMETABLE_STATS defined)
+		search_stats stats;
+
+	};
+
+	// the penalty of a single day of a timetable
+	inline score_t calculate_day_score(const timeblock_day_t day, const score_config& scorer) noexcept {
+		if (day == 0)return 0;
+		score_t answer = scorer.travel_penalty;
+		answer += (intrinsics::find_largest_set(day) - intrinsics::find_smallest_set(day) + 1) * scorer.empty_slot_penalty;
+		if (((~day) & scorer.lunch_time) == 0) {
+			answer += scorer.no_lunch_penalty;
+		}
+		return answer;
+	}
+
+	// the penalty of a timetable with the given timeblock
+	inline score_t calculate_score(const timeblock& timeblock, const score_config& scorer) noexcept {
+		score_t answer = 0;
+		std::for_each(timeblock.days, timeblock.days + TIMEBLOCK_DAY_COUNT, [&answer, &scorer](const timeblock_day_t& day) {
+			answer += calculate_day_score(day, scorer);
+		});
+		return answer;
+	}
+
 	timetable find_best(std::vector<std::pair<typename std::vector<mod>::const_iterator, typename std::vector<mod_item>::const_iterator>>&& mod_its, const score_config& scorer = default_config());
 
 	// the main searcher function
-	timetable find_best(const std::vector<mod>& mods, const score_config& scorer = default_config());
+	// the items are split into groups that have no day in common, and each group is searched on its own (one after another, each with the given number of threads)
+	// the time until the deadline is shared by the groups: each group may use an equal share of the time left when it starts (so the time a group doesn't use goes to the groups after it)
+	// if a group is stopped by the deadline without having found a timetable, no timetable is returned, but optimal is false since that doesn't prove that there is none
+	// on_improvement is only called while searching the last group, since only then is there a complete timetable to report
+	search_result find_best(const std::vector<mod>& mods, const score_config& scorer = default_config(), const search_config& config = default_search_config());
+
+	// the result of find_top_k
+	struct top_k_result {
+
+		// the best timetables found, best first
+		std::vector<timetable> timetables;
+
+		// no valid timetable other than those in timetables has a penalty less than this (the maximum score_t if it is proven that there are no others)
+		// if the search is optimal, this is the penalty of the k-th best timetable (or the maximum score_t if fewer than k were found); otherwise it also bounds the parts of the search tree that were not searched
+		score_t lower_bound;
+
+		// whether the search ran to completion, which proves that these are the k best timetables (or all the valid timetables, if there are fewer than k)
+		// this is false only if the search was stopped by the deadline
+		bool optimal;
+
+		// the number of nodes of the search tree visited (over all the threads)
+		std::size_t node_count;
+
+		// what the search did (only collected if the library is compiled with AUTOTIMETABLE_STATS defined)
+		search_stats stats;
+
+	};
+
+	// finds the k best timetables (or fewer, if there aren't k valid timetables), best first
+	// this is a single search that prunes against the k-th best timetable found so far, which is much cheaper than k separate searches
+	// if the search is stopped by the deadline, these are just the best timetables found so far
+	// unlike find_best, this searches all the items at once
+	top_k_result find_top_k(const std::vector<mod>& mods, std::size_t k, const score_config& scorer = default_config(), const search_config& config = default_search_config());
+
+	// a lesson fixed to one of its options: modules[module_index].items[item_index].choices[choice_index] of an engine
+	struct pin {
+		std::size_t module_index;
+		std::size_t item_index;
+		std::size_t choice_index;
+	};
+
+	// a set of modules prepared once for answering many queries about some of them
+	// the work that find_best and find_top_k do on every module in every call (merging the choices of an item that have the same slots, and finding the dominated choices) is done here once for every module
+	// an engine is never modified after it is made, so many threads can query it at once
+	class engine {
+	public:
+		explicit engine(std::vector<mod> mods);
+		~engine();
+		engine(const engine&) = delete;
+		engine& operator=(const engine&) = delete;
+
+		// the modules, in the order they were given
+		const std::vector<mod>& modules() const noexcept;
+
+		// the index of the module with the given code (the first one, if several have it), or modules().size() if there is none
+		std::size_t find(const std::string& code) const noexcept;
+
+		// like find_best, for the modules with the given indices, with the choices of the pinned items fixed
+		// pins of modules that are not in module_indices are ignored
+		// the timetables point into modules()
+		// throws std::invalid_argument if a module index is out of range or given more than once, or a pin is out of range
+		search_result solve(const std::vector<std::size_t>& module_indices, const std::vector<pin>& pins, const score_config& scorer = default_config(), const search_config& config = default_search_config()) const;
+
+		// like find_top_k, for the modules with the given indices, with the choices of the pinned items fixed
+		// throws std::invalid_argument like solve (unless k is 0)
+		top_k_result solve_top_k(const std::vector<std::size_t>& module_indices, const std::vector<pin>& pins, std::size_t k, const score_config& scorer = default_config(), const search_config& config = default_search_config()) const;
+
+	private:
+		struct prepared;
+		std::unique_ptr<const prepared> data;
+	};
 
 }
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include <cstdint>
+#include <cstring>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "catalog.hpp"
+
+namespace catalog {
+
+	static_assert(autotimetable::TIMEBLOCK_DAY_COUNT == 12, "the catalog format stores 12 days per timeblock");
+
+	constexpr const char CATALOG_MAGIC[8] = { 'A', 'T', 'T', 'C', 'A', 'T', 'L', 'G' };
+	constexpr const std::uint32_t CATALOG_BYTE_ORDER = 0x01020304;
+
+	struct catalog_header {
+		char magic[8];
+		std::uint32_t byte_order; // CATALOG_BYTE_ORDER as written by the machine that made the file
+		std::uint32_t version;
+		std::uint32_t module_count;
+		std::uint32_t item_count;
+		std::uint32_t choice_count;
+		std::uint32_t string_table_size;
+	};
+
+	// a string is stored as its position and length in the string table
+	struct catalog_string {
+		std::uint32_t offset;
+		std::uint32_t length;
+	};
+
+	struct catalog_module {
+		catalog_string code;
+		std::uint32_t first_item;
+		std::uint32_t item_count;
+	};
+
+	struct catalog_item {
+		catalog_string kind;
+		std::uint32_t first_choice;
+		std::uint32_t choice_count;
+	};
+
+	struct catalog_choice {
+		catalog_string name;
+		autotimetable::timeblock_day_t days[autotimetable::TIMEBLOCK_DAY_COUNT];
+	};
+
+	// the records are read in place from the mapped file, so they must not need any padding
+	static_assert(sizeof(catalog_header) == 32 && sizeof(catalog_module) == 16 && sizeof(catalog_item) == 16 && sizeof(catalog_choice) == 56, "catalog records must be packed");
+
+
+	inline std::uint32_t checked_size(const std::size_t size) {
+		if (size > UINT32_MAX)throw std::length_error("Module data too large for the catalog format.");
+		return static_cast<std::uint32_t>(size);
+	}
+
+	template <typename T>
+	inline void write_records(std::ostream& out, const std::vector<T>& records) {
+		out.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(T)));
+	}
+
+	void write_catalog(std::ostream& out, const std::vector<autotimetable::mod>& mods) {
+		std::vector<const autotimetable::mod*> sorted_mods;
+		sorted_mods.reserve(mods.size());
+		for (const autotimetable::mod& mod : mods) {
+			sorted_mods.emplace_back(&mod);
+		}
+		// the stable sort keeps the first of several modules with the same code in front, so unique keeps it
+		std::stable_sort(sorted_mods.begin(), sorted_mods.end(), [](const autotimetable::mod* a, const autotimetable::mod* b) {
+			return a->code < b->code;
+		});
+		sorted_mods.erase(std::unique(sorted_mods.begin(), sorted_mods.end(), [](const autotimetable::mod* a, const autotimetable::mod* b) {
+			return a->code == b->code;
+		}), sorted_mods.end());
+
+		std::vector<catalog_module> modules;
+		std::vector<catalog_item> items;
+		std::vector<catalog_choice> choices;
+		std::string strings;
+		auto add_string = [&strings](const std::string& str) {
+			catalog_string ret{ checked_size(strings.size()), checked_size(str.size()) };
+			strings += str;
+			return ret;
+		};
+		for (const autotimetable::mod* mod : sorted_mods) {
+			modules.emplace_back(catalog_module{ add_string(mod->code), checked_size(items.size()), checked_size(mod->items.size()) });
+			for (const autotimetable::mod_item& item : mod->items) {
+				items.emplace_back(catalog_item{ add_string(item.kind), checked_size(choices.size()), checked_size(item.choices.size()) });
+				for (const autotimetable::mod_item_choice& choice : item.choices) {
+					catalog_choice record;
+					record.name = add_string(choice.name);
+					std::copy_n(choice.timeblock.days, autotimetable::TIMEBLOCK_DAY_COUNT, record.days);
+					choices.emplace_back(record);
+				}
+			}
+		}
+
+		catalog_header header;
+		std::copy_n(CATALOG_MAGIC, sizeof(CATALOG_MAGIC), header.magic);
+		header.byte_order = CATALOG_BYTE_ORDER;
+		header.version = CATALOG_VERSION;
+		header.module_count = checked_size(modules.size());
+		header.item_count = checked_size(items.size());
+		header.choice_count = checked_size(choices.size());
+		header.string_table_size = checked_size(strings.size());
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		write_records(out, modules);
+		write_records(out, items);
+		write_records(out, choices);
+		out.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+	}
+
+
+	// the sections of a mapped catalog, found from the counts in its header
+	struct catalog_sections {
+		const catalog_module* modules;
+		const catalog_item* items;
+		const catalog_choice* choices;
+		const char* strings;
+		const catalog_header* header;
+
+		explicit catalog_sections(const unsigned char* data) noexcept :
+			modules(reinterpret_cast<const catalog_module*>(data + sizeof(catalog_header))),
+			items(reinterpret_cast<const catalog_item*>(modules + reinterpret_cast<const catalog_header*>(data)->module_count)),
+			choices(reinterpret_cast<const catalog_choice*>(items + reinterpret_cast<const catalog_header*>(data)->item_count)),
+			strings(reinterpret_cast<const char*>(choices + reinterpret_cast<const catalog_header*>(data)->choice_count)),
+			header(reinterpret_cast<const catalog_header*>(data)) {}
+
+		inline std::string get(const catalog_string& str) const {
+			if (str.offset > header->string_table_size || str.length > header->string_table_size - str.offset)throw std::runtime_error("Catalog string out of range.");
+			return std::string(strings + str.offset, str.length);
+		}
+
+		// compares the given string in the string table with the given code, like std::string::compare
+		inline int compare(const catalog_string& str, const std::string& code) const {
+			if (str.offset > header->string_table_size || str.length > header->string_table_size - str.offset)throw std::runtime_error("Catalog string out of range.");
+			const int ret = std::memcmp(strings + str.offset, code.data(), std::min<std::size_t>(str.length, code.size()));
+			if (ret != 0)return ret;
+			return str.length < code.size() ? -1 : str.length > code.size() ? 1 : 0;
+		}
+	};
+
+	mapped_catalog::mapped_catalog(const std::string& path) : data(nullptr), length(0) {
+#if defined(_WIN32)
+		file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file_handle == INVALID_HANDLE_VALUE)throw std::runtime_error("Cannot open catalog file \"" + path + "\".");
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file_handle, &file_size)) {
+			CloseHandle(file_handle);
+			throw std::runtime_error("Cannot read catalog file \"" + path + "\".");
+		}
+		length = static_cast<std::size_t>(file_size.QuadPart);
+		mapping_handle = length == 0 ? nullptr : CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping_handle)data = static_cast<const unsigned char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+		if (!data) {
+			if (mapping_handle)CloseHandle(mapping_handle);
+			CloseHandle(file_handle);
+			throw std::runtime_error("Cannot map catalog file \"" + path + "\".");
+		}
+#else
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd == -1)throw std::runtime_error("Cannot open catalog file \"" + path + "\".");
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) == -1) {
+			close(fd);
+			throw std::runtime_error("Cannot read catalog file \"" + path + "\".");
+		}
+		length = static_cast<std::size_t>(file_stat.st_size);
+		void* mapping = length == 0 ? MAP_FAILED : mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); // the mapping stays valid after the file is closed
+		if (mapping == MAP_FAILED)throw std::runtime_error("Cannot map catalog file \"" + path + "\".");
+		data = static_cast<const unsigned char*>(mapping);
+#endif
+
+		// check that the header is ours, and that the sections it describes fit in the file
+		const char* error = nullptr;
+		const catalog_header* header = reinterpret_cast<const catalog_header*>(data);
+		if (length < sizeof(catalog_header) || !std::equal(CATALOG_MAGIC, CATALOG_MAGIC + sizeof(CATALOG_MAGIC), header->magic)) {
+			error = "is not a catalog";
+		}
+		else if (header->byte_order != CATALOG_BYTE_ORDER) {
+			error = "was made on a machine with a different byte order";
+		}
+		else if (header->version != CATALOG_VERSION) {
+			error = "was made by a different version of the catalog format";
+		}
+		else if (sizeof(catalog_header) + header->module_count * std::uint64_t{ sizeof(catalog_module) } + header->item_count * std::uint64_t{ sizeof(catalog_item) } + header->choice_count * std::uint64_t{ sizeof(catalog_choice) } + header->string_table_size != length) {
+			error = "is truncated or corrupt";
+		}
+		if (error) {
+			unmap();
+			throw std::runtime_error("Catalog file \"" + path + "\" " + error + ".");
+		}
+	}
+
+	mapped_catalog::~mapped_catalog() {
+		unmap();
+	}
+
+	void mapped_catalog::unmap() noexcept {
+#if defined(_WIN32)
+		UnmapViewOfFile(data);
+		CloseHandle(mapping_handle);
+		CloseHandle(file_handle);
+#else
+		munmap(const_cast<unsigned char*>(data), length);
+#endif
+	}
+
+	std::size_t mapped_catalog::size() const noexcept {
+		return reinterpret_cast<const catalog_header*>(data)->module_count;
+	}
+
+	// builds the module in the directory entry into out
+	inline void build_module(const catalog_sections& sections, const catalog_module& module, autotimetable::mod& out) {
+		const catalog_header& header = *sections.header;
+		out.code = sections.get(module.code);
+		if (module.first_item > header.item_count || module.item_count > header.item_count - module.first_item)throw std::runtime_error("Catalog module " + out.code + " out of range.");
+		out.items.clear();
+		out.items.reserve(module.item_count);
+		for (const catalog_item* item = sections.items + module.first_item; item != sections.items + module.first_item + module.item_count; ++item) {
+			if (item->first_choice > header.choice_count || item->choice_count > header.choice_count - item->first_choice)throw std::runtime_error("Catalog module " + out.code + " out of range.");
+			autotimetable::mod_item mod_item{ sections.get(item->kind), {} };
+			mod_item.choices.reserve(item->choice_count);
+			for (const catalog_choice* choice = sections.choices + item->first_choice; choice != sections.choices + item->first_choice + item->choice_count; ++choice) {
+				autotimetable::mod_item_choice mod_item_choice{ sections.get(choice->name), autotimetable::timeblock() };
+				std::copy_n(choice->days, autotimetable::TIMEBLOCK_DAY_COUNT, mod_item_choice.timeblock.days);
+				mod_item.choices.emplace_back(std::move(mod_item_choice));
+			}
+			out.items.emplace_back(std::move(mod_item));
+		}
+	}
+
+	bool mapped_catalog::find(const std::string& code, autotimetable::mod& out) const {
+		const catalog_sections sections(data);
+		const catalog_module* modules_end = sections.modules + sections.header->module_count;
+		const catalog_module* module = std::lower_bound(sections.modules, modules_end, code, [&sections](const catalog_module& module, const std::string& code) {
+			return sections.compare(module.code, code) < 0;
+		});
+		if (module == modules_end || sections.compare(module->code, code) != 0)return false;
+		build_module(sections, *module, out);
+		return true;
+	}
+
+	std::vector<autotimetable::mod> mapped_catalog::modules() const {
+		const catalog_sections sections(data);
+		std::vector<autotimetable::mod> ret(sections.header->module_count);
+		for (std::size_t i = 0; i < ret.size(); ++i) {
+			build_module(sections, sections.modules[i], ret[i]);
+		}
+		return ret;
+	}
+
+}
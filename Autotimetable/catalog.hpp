@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "autotimetable.hpp"
+
+namespace catalog {
+
+	// the binary catalog format is a header, followed by the module directory (sorted by module code), the items, the choices (with their timeblocks ready to use) and a string table
+	// everything is stored as 32-bit integers in the byte order of the machine that wrote it, so the file can be used in place once it is mapped into memory
+	// the version is increased whenever the format changes, and files of any other version are rejected
+	constexpr const std::uint32_t CATALOG_VERSION = 1;
+
+	// writes the modules as a binary catalog (if several modules have the same code, only the first one is kept)
+	void write_catalog(std::ostream& out, const std::vector<autotimetable::mod>& mods);
+
+	// a binary catalog mapped into memory, read in place
+	// looking up a module is a binary search over the directory, and building it copies its names and timeblocks without interpreting anything
+	class mapped_catalog {
+	public:
+		// throws std::runtime_error if the file cannot be mapped, or is not a catalog of the current version made on a machine with the same byte order
+		explicit mapped_catalog(const std::string& path);
+		~mapped_catalog();
+		mapped_catalog(const mapped_catalog&) = delete;
+		mapped_catalog& operator=(const mapped_catalog&) = delete;
+
+		// the number of modules in the catalog
+		std::size_t size() const noexcept;
+
+		// builds the module with the given code into out, and returns false if there is no such module
+		// throws std::runtime_error if the part of the file with the module is corrupt
+		bool find(const std::string& code, autotimetable::mod& out) const;
+
+		// builds every module, sorted by code
+		// like find, this copies every name and timeblock out of the mapping, so loading the whole catalog only saves the time spent parsing the module file, not the copying or the memory
+		// throws std::runtime_error if the file is corrupt
+		std::vector<autotimetable::mod> modules() const;
+
+	private:
+		void unmap() noexcept;
+
+		const unsigned char* data;
+		std::size_t length;
+#if defined(_WIN32)
+		void* file_handle;
+		void* mapping_handle;
+#endif
+	};
+
+}
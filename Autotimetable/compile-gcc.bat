@@ -1 +1 @@
-g++ -Wall -DNDEBUG autotimetable.cpp main.cpp -o autotimetable.exe -O3 -march=native -std=c++14
+g++ -Wall -DNDEBUG autotimetable.cpp module_loader.cpp catalog.cpp query.cpp server.cpp main.cpp -o autotimetable.exe -O3 -march=native -std=c++14 -pthread
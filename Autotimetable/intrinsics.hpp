@@ -22,6 +22,17 @@ namespace intrinsics {
 		return static_cast<std::uint32_t>(res);
 	}
 
+	// assumes at least one set bit
+	inline std::uint32_t find_smallest_set(std::uint64_t mask) {
+		const std::uint32_t low = static_cast<std::uint32_t>(mask);
+		if (low != 0)return find_smallest_set(low);
+		return 32u + find_smallest_set(static_cast<std::uint32_t>(mask >> 32));
+	}
+
+	inline std::uint32_t count_set(std::uint64_t mask) {
+		return static_cast<std::uint32_t>(__popcnt(static_cast<unsigned int>(mask)) + __popcnt(static_cast<unsigned int>(mask >> 32)));
+	}
+
 }
 
 #elif defined(__GNUC__)
@@ -38,7 +49,180 @@ namespace intrinsics {
 		return static_cast<std::uint32_t>(__builtin_ctz(mask));
 	}
 
+	// assumes at least one set bit
+	inline std::uint32_t find_smallest_set(std::uint64_t mask) {
+		return static_cast<std::uint32_t>(__builtin_ctzll(mask));
+	}
+
+	inline std::uint32_t count_set(std::uint64_t mask) {
+		return static_cast<std::uint32_t>(__builtin_popcountll(mask));
+	}
+
+}
+
+#endif
+
+
+
+// bitwise operations on arrays of 32-bit lanes, used for the timeblock operations in the innermost loops of the search
+// the length of the arrays must be a multiple of intrinsics::lane_block (the number of lanes in one vector register)
+// loads and stores are unaligned, because std::vector does not guarantee more than the default alignment
+// define AUTOTIMETABLE_NO_SIMD to use the scalar versions
+
+#if !defined(AUTOTIMETABLE_NO_SIMD) && defined(__AVX2__)
+
+#include <cstddef>
+#include <immintrin.h>
+
+namespace intrinsics {
+
+	constexpr const std::size_t lane_block = 8;
+
+	template <std::size_t N>
+	inline void or_lanes(std::uint32_t* dest, const std::uint32_t* src) noexcept {
+		for (std::size_t i = 0; i < N; i += lane_block) {
+			__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + i));
+			__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_or_si256(d, s));
+		}
+	}
+
+	template <std::size_t N>
+	inline void andnot_lanes(std::uint32_t* dest, const std::uint32_t* src) noexcept {
+		for (std::size_t i = 0; i < N; i += lane_block) {
+			__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + i));
+			__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_andnot_si256(s, d));
+		}
+	}
+
+	// returns true if some bit is set in both arrays
+	template <std::size_t N>
+	inline bool intersect_lanes(const std::uint32_t* a, const std::uint32_t* b) noexcept {
+		__m256i acc = _mm256_setzero_si256();
+		for (std::size_t i = 0; i < N; i += lane_block) {
+			__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+			__m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+			acc = _mm256_or_si256(acc, _mm256_and_si256(x, y));
+		}
+		return !_mm256_testz_si256(acc, acc);
+	}
+
+	template <std::size_t N>
+	inline bool equal_lanes(const std::uint32_t* a, const std::uint32_t* b) noexcept {
+		__m256i acc = _mm256_setzero_si256();
+		for (std::size_t i = 0; i < N; i += lane_block) {
+			__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+			__m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+			acc = _mm256_or_si256(acc, _mm256_xor_si256(x, y));
+		}
+		return _mm256_testz_si256(acc, acc) != 0;
+	}
+
 }
 
+#elif !defined(AUTOTIMETABLE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+
+#include <cstddef>
+#include <emmintrin.h>
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
 #endif
 
+namespace intrinsics {
+
+	constexpr const std::size_t lane_block = 4;
+
+	inline bool _is_zero(const __m128i x) noexcept {
+#if defined(__SSE4_1__)
+		return _mm_testz_si128(x, x) != 0;
+#else
+		return _mm_movemask_epi8(_mm_cmpeq_epi32(x, _mm_setzero_si128())) == 0xFFFF;
+#endif
+	}
+
+	template <std::size_t N>
+	inline void or_lanes(std::uint32_t* dest, const std::uint32_t* src) noexcept {
+		for (std::size_t i = 0; i < N; i += lane_block) {
+			__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + i));
+			__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_or_si128(d, s));
+		}
+	}
+
+	template <std::size_t N>
+	inline void andnot_lanes(std::uint32_t* dest, const std::uint32_t* src) noexcept {
+		for (std::size_t i = 0; i < N; i += lane_block) {
+			__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + i));
+			__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_andnot_si128(s, d));
+		}
+	}
+
+	// returns true if some bit is set in both arrays
+	template <std::size_t N>
+	inline bool intersect_lanes(const std::uint32_t* a, const std::uint32_t* b) noexcept {
+		__m128i acc = _mm_setzero_si128();
+		for (std::size_t i = 0; i < N; i += lane_block) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+			__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+			acc = _mm_or_si128(acc, _mm_and_si128(x, y));
+		}
+		return !_is_zero(acc);
+	}
+
+	template <std::size_t N>
+	inline bool equal_lanes(const std::uint32_t* a, const std::uint32_t* b) noexcept {
+		__m128i acc = _mm_setzero_si128();
+		for (std::size_t i = 0; i < N; i += lane_block) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+			__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+			acc = _mm_or_si128(acc, _mm_xor_si128(x, y));
+		}
+		return _is_zero(acc);
+	}
+
+}
+
+#else
+
+#include <cstddef>
+
+namespace intrinsics {
+
+	constexpr const std::size_t lane_block = 1;
+
+	template <std::size_t N>
+	inline void or_lanes(std::uint32_t* dest, const std::uint32_t* src) noexcept {
+		for (std::size_t i = 0; i < N; ++i) {
+			dest[i] |= src[i];
+		}
+	}
+
+	template <std::size_t N>
+	inline void andnot_lanes(std::uint32_t* dest, const std::uint32_t* src) noexcept {
+		for (std::size_t i = 0; i < N; ++i) {
+			dest[i] &= ~src[i];
+		}
+	}
+
+	// returns true if some bit is set in both arrays
+	template <std::size_t N>
+	inline bool intersect_lanes(const std::uint32_t* a, const std::uint32_t* b) noexcept {
+		for (std::size_t i = 0; i < N; ++i) {
+			if ((a[i] & b[i]) != 0)return true;
+		}
+		return false;
+	}
+
+	template <std::size_t N>
+	inline bool equal_lanes(const std::uint32_t* a, const std::uint32_t* b) noexcept {
+		for (std::size_t i = 0; i < N; ++i) {
+			if (a[i] != b[i])return false;
+		}
+		return true;
+	}
+
+}
+
+#endif
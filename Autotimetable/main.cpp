@@ -13,18 +13,63 @@
 #include <tuple>
 #include <algorithm>
 #include <numeric>
+#include <limits>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
-#include <map>
 #include <stdexcept>
 #include <chrono>
+#include <memory>
+#include <thread>
+#include <atomic>
 
 #include "intrinsics.hpp"
 
-#include "json.hpp"
-
 #include "autotimetable.hpp"
+#include "module_loader.hpp"
+#include "catalog.hpp"
+#include "query.hpp"
+#include "server.hpp"
+
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+#include <atomic>
+
+// counts every heap allocation made by the program, so that we can check that the search itself does not allocate
+// (the number of allocations made by autotimetable should depend only on the number of modules, not on how long the search takes)
+// the allocations of every thread are also counted in autotimetable::thread_allocation_count, which the search uses to check that its loop makes none
+std::atomic<std::size_t> allocation_count(0);
+
+void* operator new(std::size_t size) {
+	++allocation_count;
+	++autotimetable::thread_allocation_count;
+	if (void* ptr = std::malloc(size == 0 ? 1 : size))return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+	std::free(ptr);
+}
+
+#endif
 
 // returns false if cannot be found
 // if found, returns pointer to null if no value, otherwise returns pointer to first char in value
@@ -71,67 +116,6 @@ inline bool read_optional_param(int argc, char* argv[], const char* key, std::st
 	}
 }
 
-inline unsigned int parse_day(const std::string& daytext) {
-	if (daytext == "Monday")return 0;
-	if (daytext == "Tuesday")return 1;
-	if (daytext == "Wednesday")return 2;
-	if (daytext == "Thursday")return 3;
-	if (daytext == "Friday")return 4;
-	if (daytext == "Saturday")return 5;
-	throw std::invalid_argument("Argument \"" + daytext + "\" not interpretable as day of week.");
-}
-
-enum : unsigned int {
-	WEEK_ODD = 1, WEEK_EVEN = 2
-};
-
-inline unsigned int parse_weektype(const std::string& weektext) {
-	if (weektext == "Odd Week")return WEEK_ODD;
-	if (weektext == "Even Week")return WEEK_EVEN;
-	if (weektext == "Every Week")return WEEK_ODD | WEEK_EVEN;
-	if (weektext == "0,1,2,3,4,5,6,7,8,9,10,11,12,13")return WEEK_ODD | WEEK_EVEN;
-	throw std::invalid_argument("Argument \"" + weektext + "\" not interpretable as week type.");
-}
-
-inline unsigned int parse_weektype_lenient(const std::string& weektext, std::string& error) noexcept {
-	if (weektext == "Odd Week")return WEEK_ODD;
-	if (weektext == "Even Week")return WEEK_EVEN;
-	if (weektext == "Every Week")return WEEK_ODD | WEEK_EVEN;
-	if (weektext == "0,1,2,3,4,5,6,7,8,9,10,11,12,13")return WEEK_ODD | WEEK_EVEN;
-	error = "Argument \"" + weektext + "\" not interpretable as week type, will be treated as a weekly lesson.";
-	return WEEK_ODD | WEEK_EVEN; // if we can't tell, just say its every week for good measure
-}
-
-template <typename Callback>
-inline autotimetable::timeblock get_timeblock_from_json_choice(const nlohmann::json& json_choice, Callback soft_error_callback) {
-	autotimetable::timeblock ret;
-
-	std::string weektext = json_choice["WeekText"].get<std::string>();
-	std::string daytext = json_choice["DayText"].get<std::string>();
-	std::string starttimetext = json_choice["StartTime"].get<std::string>();
-	std::string endtimetext = json_choice["EndTime"].get<std::string>();
-
-	std::string weekerr;
-	unsigned int weekmask = parse_weektype_lenient(weektext, weekerr);
-	if (!weekerr.empty())soft_error_callback(weekerr);
-	unsigned int daynum = parse_day(daytext);
-	unsigned int starttime = static_cast<unsigned int>(std::stoul(starttimetext)) / 100;
-	unsigned int endtime = (static_cast<unsigned int>(std::stoul(endtimetext)) + 99) / 100; // round times up to nearest hour
-	if (daynum >= (autotimetable::TIMEBLOCK_DAY_COUNT >> 1))throw std::invalid_argument("Day of week not valid.");
-	if (starttime >= endtime)throw std::invalid_argument("Time range not valid.");
-
-	autotimetable::timeblock_day_t dayres = 0;
-	for (unsigned int i = starttime; i < endtime; ++i) {
-		dayres |= (1u << i);
-	}
-
-	if (weekmask & WEEK_ODD)ret.days[daynum] = dayres;
-	if (weekmask & WEEK_EVEN)ret.days[(autotimetable::TIMEBLOCK_DAY_COUNT >> 1) + daynum] = dayres;
-
-	return ret;
-}
-
-
 inline void print_header(std::ostream& out, unsigned begin_index, unsigned end_index, unsigned width) {
 	out << std::setw(0) << '|';
 	for (unsigned i = begin_index; i < end_index; ++i) {
@@ -229,38 +213,149 @@ inline void print_modchoice(std::ostream& out, unsigned begin_index, unsigned en
 }
 
 
-inline std::tuple<std::string, std::string, std::string> parse_fixed_mod(const std::string& fixed_mods_str, std::size_t begin, std::size_t end) {
-	std::size_t c1 = fixed_mods_str.find(':', begin);
-	if (c1 == std::string::npos) {
-		throw std::invalid_argument("Cannot parse fixed mod selection: \"" + fixed_mods_str.substr(begin, end - begin) + "\".");
-	}
-	std::size_t c2 = fixed_mods_str.find(':', c1 + 1);
-	if (c2 == std::string::npos) {
-		throw std::invalid_argument("Cannot parse fixed mod selection: \"" + fixed_mods_str.substr(begin, end - begin) + "\".");
+// prints the timetable as one table for odd weeks and one table for even weeks
+// returns false (without printing anything) if the timetable is empty
+inline bool print_timetable(std::ostream& out, const autotimetable::timetable& find_result) {
+	// find the first and last hours to print
+	unsigned begin_index = std::accumulate(find_result.items.cbegin(), find_result.items.cend(), 24u, [](unsigned prev, const std::tuple<typename std::vector<autotimetable::mod>::const_iterator, typename std::vector<autotimetable::mod_item>::const_iterator, typename std::vector<autotimetable::mod_item_choice>::const_iterator>& curr) {
+		return std::min(prev, std::accumulate(std::get<2>(curr)->timeblock.days, std::get<2>(curr)->timeblock.days + autotimetable::TIMEBLOCK_DAY_COUNT, 24u, [](unsigned prev, const autotimetable::timeblock_day_t& curr) {
+			if (curr == 0)return prev;
+			return std::min(prev, intrinsics::find_smallest_set(curr));
+		}));
+	});
+	unsigned end_index = std::accumulate(find_result.items.cbegin(), find_result.items.cend(), 0u, [](unsigned prev, const std::tuple<typename std::vector<autotimetable::mod>::const_iterator, typename std::vector<autotimetable::mod_item>::const_iterator, typename std::vector<autotimetable::mod_item_choice>::const_iterator>& curr) {
+		return std::max(prev, std::accumulate(std::get<2>(curr)->timeblock.days, std::get<2>(curr)->timeblock.days + autotimetable::TIMEBLOCK_DAY_COUNT, 0u, [](unsigned prev, const autotimetable::timeblock_day_t& curr) {
+			if (curr == 0)return prev;
+			return std::max(prev, intrinsics::find_largest_set(curr));
+		}));
+	}) + 1;
+
+	if (begin_index >= end_index) {
+		return false;
 	}
-	std::size_t c3 = fixed_mods_str.find(':', c2 + 1);
-	if (c3 < end) {
-		throw std::invalid_argument("Cannot parse fixed mod selection: \"" + fixed_mods_str.substr(begin, end - begin) + "\".");
+	else {
+
+		// print the result nicely
+		out << "=== Odd Week ===" << std::endl;
+		print_spacer(out, begin_index, end_index, 8);
+		print_header(out, begin_index, end_index, 8);
+		print_spacer(out, begin_index, end_index, 8);
+		for (unsigned i = 0; i < 6; ++i) {
+			if (i % 6 != 5 || find_result.timeblock.days[i] != 0) {
+				print_modname(out, begin_index, end_index, 8, find_result, i);
+				print_modkind(out, begin_index, end_index, 8, find_result, i);
+				print_modchoice(out, begin_index, end_index, 8, find_result, i);
+				print_spacer(out, begin_index, end_index, 8);
+			}
+		}
+		out << std::endl;
+		out << "=== Even Week ===" << std::endl;
+		print_spacer(out, begin_index, end_index, 8);
+		print_header(out, begin_index, end_index, 8);
+		print_spacer(out, begin_index, end_index, 8);
+		for (unsigned i = 6; i < 12; ++i) {
+			if (i % 6 != 5 || find_result.timeblock.days[i] != 0) {
+				print_modname(out, begin_index, end_index, 8, find_result, i);
+				print_modkind(out, begin_index, end_index, 8, find_result, i);
+				print_modchoice(out, begin_index, end_index, 8, find_result, i);
+				print_spacer(out, begin_index, end_index, 8);
+			}
+		}
+		
 	}
-	return std::tuple<std::string, std::string, std::string>(fixed_mods_str.substr(begin, c1 - begin), fixed_mods_str.substr(c1 + 1, c2 - (c1 + 1)), fixed_mods_str.substr(c2 + 1, end - (c2 + 1)));
+	return true;
 }
 
 
-int main(int argc, char *argv[]) {
-	std::string modulefilepath;
-	if (!read_required_param(argc, argv, "--modulefile", "Fatal error: module file not specified.  Use \"--modulefile=<filename>\".", modulefilepath))return 0;
+// loads every module of the module file or catalog into an engine, for answering many queries
+// returns nullptr (after saying why) if the modules cannot be loaded
+inline std::unique_ptr<autotimetable::engine> load_engine(bool use_catalog, const std::string& catalogfilepath, const std::string& modulefilepath, bool quiet) {
+	std::cout << "Loading modules..." << std::endl;
+	std::vector<autotimetable::mod> all_mods;
+	if (use_catalog) {
+		try {
+			// the modules are copied out of the catalog, so this only saves parsing the module file; the engine keeps its own copy either way
+			all_mods = catalog::mapped_catalog(catalogfilepath).modules();
+		}
+		catch (const std::runtime_error& err) {
+			std::cout << "Fatal error: " << err.what() << std::endl;
+			return nullptr;
+		}
+	}
+	else {
+		std::ifstream in(modulefilepath, std::ios_base::in | std::ios_base::binary);
+		if (!in) {
+			std::cout << "Fatal error: cannot open module file \"" << modulefilepath << "\"." << std::endl;
+			return nullptr;
+		}
+		try {
+			all_mods = module_loader::load_modules(in, [](const std::string&) {
+				return true;
+			}, [quiet](const std::string& warning) {
+				if (!quiet)std::cout << warning << std::endl;
+			});
+		}
+		catch (const std::invalid_argument& err) {
+			std::cout << "Fatal error: " << err.what() << std::endl;
+			return nullptr;
+		}
+	}
+	std::cout << "Done loading modules." << std::endl;
 
+	std::cout << "Preparing modules..." << std::endl;
+	std::unique_ptr<autotimetable::engine> ret(new autotimetable::engine(std::move(all_mods)));
+	for (std::size_t i = 0; i < ret->modules().size(); ++i) {
+		if (ret->find(ret->modules()[i].code) != i) {
+			std::cout << "Duplicate module " << ret->modules()[i].code << ", module will be skipped" << std::endl;
+		}
+	}
+	std::cout << "Done preparing modules." << std::endl;
+	return ret;
+}
 
-	std::string required_mods_str;
-	if (!read_required_param(argc, argv, "--required", "Fatal error: required modules not specified.  Use \"--required=<module code 1>,<module code 2>,...\", e.g. \"--required=CS1010,MA1101R,CS1231,BN1101,GET1002\" (without spaces).", required_mods_str))return 0;
 
-	std::string fixed_mods_str;
-	read_optional_param(argc, argv, "--fixed", fixed_mods_str);
-	for (char& ch : fixed_mods_str) {
-		if (ch == '-' || ch == '_')ch = ' ';
+int main(int argc, char *argv[]) {
+	std::string modulefilepath;
+	std::string catalogfilepath;
+	bool use_catalog = read_optional_param(argc, argv, "--catalogfile", catalogfilepath);
+	if (!use_catalog && !read_required_param(argc, argv, "--modulefile", "Fatal error: module file not specified.  Use \"--modulefile=<filename>\" (or \"--catalogfile=<filename>\").", modulefilepath))return 0;
+
+	// compile-catalog mode: convert the module file into a binary catalog, and do nothing else
+	std::string compile_catalog_path;
+	if (read_optional_param(argc, argv, "--compile-catalog", compile_catalog_path)) {
+		if (use_catalog) {
+			std::cout << "Fatal error: --compile-catalog reads the module file, so it cannot be used with --catalogfile.  Use \"--modulefile=<filename>\" instead." << std::endl;
+			return 0;
+		}
+		std::cout << "Compiling catalog..." << std::endl;
+		std::ifstream in(modulefilepath, std::ios_base::in | std::ios_base::binary);
+		if (!in) {
+			std::cout << "Fatal error: cannot open module file \"" << modulefilepath << "\"." << std::endl;
+			return 0;
+		}
+		std::vector<autotimetable::mod> all_mods;
+		try {
+			all_mods = module_loader::load_modules(in, [](const std::string&) {
+				return true;
+			}, [](const std::string& warning) {
+				std::cout << warning << std::endl;
+			});
+		}
+		catch (const std::invalid_argument& err) {
+			std::cout << "Fatal error: " << err.what() << std::endl;
+			return 0;
+		}
+		std::ofstream out(compile_catalog_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		catalog::write_catalog(out, all_mods);
+		out.close();
+		if (!out) {
+			std::cout << "Fatal error: cannot write catalog file \"" << compile_catalog_path << "\"." << std::endl;
+			return 0;
+		}
+		std::cout << "Done compiling catalog of " << all_mods.size() << " modules." << std::endl;
+		return 0;
 	}
 
-
 	bool quiet = false;
 	{
 		std::string quiet_str;
@@ -277,6 +372,165 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	// the number of queries answered at once in the daemon and batch modes
+	unsigned worker_count = std::thread::hardware_concurrency();
+	{
+		std::string override_worker_count;
+		if (read_optional_param(argc, argv, "--workers", override_worker_count)) {
+			try {
+				worker_count = static_cast<unsigned>(std::stoul(override_worker_count));
+			}
+			catch (...) {
+				std::cout << "Warning: Cannot interpret value for --workers, ignoring it." << std::endl;
+			}
+		}
+		if (worker_count == 0)worker_count = 1;
+	}
+	// the largest transposition table of a search, in every mode (a query of the daemon and batch modes can ask for a different size)
+	std::size_t transposition_table_size = autotimetable::default_search_config().transposition_table_size;
+	{
+		std::string override_transposition_table_size;
+		if (read_optional_param(argc, argv, "--transposition-table-size", override_transposition_table_size)) {
+			try {
+				transposition_table_size = static_cast<std::size_t>(std::min<unsigned long long>(std::stoull(override_transposition_table_size), std::numeric_limits<std::size_t>::max()));
+			}
+			catch (...) {
+				std::cout << "Warning: Cannot interpret value for --transposition-table-size, ignoring it." << std::endl;
+			}
+		}
+	}
+	// in the daemon and batch modes, every query is searched with one thread, since the workers already answer many queries at once
+	autotimetable::search_config query_search_config = autotimetable::default_search_config();
+	query_search_config.thread_count = 1;
+	query_search_config.transposition_table_size = transposition_table_size;
+	// what a query of the daemon and batch modes may ask for
+	query::limits query_limits = query::default_limits();
+	{
+		std::string override_limit;
+		if (read_optional_param(argc, argv, "--max-top", override_limit)) {
+			try {
+				query_limits.max_top = static_cast<std::size_t>(std::min<unsigned long long>(std::stoull(override_limit), std::numeric_limits<std::size_t>::max()));
+			}
+			catch (...) {
+				std::cout << "Warning: Cannot interpret value for --max-top, ignoring it." << std::endl;
+			}
+		}
+		if (read_optional_param(argc, argv, "--default-time-limit", override_limit)) {
+			try {
+				query_limits.default_time_limit = static_cast<std::chrono::milliseconds::rep>(std::min<unsigned long long>(std::stoull(override_limit), std::numeric_limits<std::chrono::milliseconds::rep>::max()));
+			}
+			catch (...) {
+				std::cout << "Warning: Cannot interpret value for --default-time-limit, ignoring it." << std::endl;
+			}
+		}
+		if (read_optional_param(argc, argv, "--max-time-limit", override_limit)) {
+			try {
+				query_limits.max_time_limit = static_cast<std::chrono::milliseconds::rep>(std::min<unsigned long long>(std::stoull(override_limit), std::numeric_limits<std::chrono::milliseconds::rep>::max()));
+			}
+			catch (...) {
+				std::cout << "Warning: Cannot interpret value for --max-time-limit, ignoring it." << std::endl;
+			}
+		}
+	}
+
+	// daemon mode: load the modules once, and answer queries sent as lines of JSON over a Unix domain socket until killed
+	std::string socket_path;
+	if (read_optional_param(argc, argv, "--serve", socket_path)) {
+		const std::unique_ptr<autotimetable::engine> engine = load_engine(use_catalog, catalogfilepath, modulefilepath, quiet);
+		if (!engine)return 0;
+		std::cout << "Serving queries on \"" << socket_path << "\" with " << worker_count << " workers." << std::endl;
+		try {
+			server::serve(socket_path, worker_count, [&engine, &query_search_config, &query_limits](const std::string& line) {
+				return query::answer(line, *engine, query_search_config, query_limits);
+			});
+		}
+		catch (const std::runtime_error& err) {
+			std::cout << "Fatal error: " << err.what() << std::endl;
+		}
+		return 0;
+	}
+
+	// batch mode: load the modules once, answer every line of JSON in the batch file with all the workers, and write the answers in the same order
+	std::string batchfilepath;
+	if (read_optional_param(argc, argv, "--batch", batchfilepath)) {
+		std::string outputfilepath;
+		if (!read_required_param(argc, argv, "--output", "Fatal error: output file not specified.  Use \"--output=<filename>\" with \"--batch\".", outputfilepath))return 0;
+		std::vector<std::string> lines;
+		{
+			std::ifstream in(batchfilepath);
+			if (!in) {
+				std::cout << "Fatal error: cannot open batch file \"" << batchfilepath << "\"." << std::endl;
+				return 0;
+			}
+			// blank lines are kept (and answered with an error), so that the n-th answer is always on the same line as the n-th query
+			for (std::string line; std::getline(in, line); ) {
+				if (!line.empty() && line.back() == '\r')line.pop_back();
+				lines.emplace_back(std::move(line));
+			}
+		}
+		const std::unique_ptr<autotimetable::engine> engine = load_engine(use_catalog, catalogfilepath, modulefilepath, quiet);
+		if (!engine)return 0;
+
+		std::cout << "Answering " << lines.size() << " queries with " << worker_count << " workers..." << std::endl;
+		std::vector<std::string> answers(lines.size());
+		std::vector<std::chrono::steady_clock::duration> latencies(lines.size());
+		std::atomic<std::size_t> next_index(0);
+		std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+		{
+			std::vector<std::thread> workers;
+			for (unsigned i = 0; i < worker_count; ++i) {
+				workers.emplace_back([&]() {
+					for (std::size_t index; (index = next_index++) < lines.size(); ) {
+						std::chrono::steady_clock::time_point query_start_time = std::chrono::steady_clock::now();
+						answers[index] = query::answer(lines[index], *engine, query_search_config, query_limits);
+						latencies[index] = std::chrono::steady_clock::now() - query_start_time;
+					}
+				});
+			}
+			for (std::thread& worker : workers) {
+				worker.join();
+			}
+		}
+		auto microseconds_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+		std::cout << "Done answering queries." << std::endl;
+
+		std::ofstream out(outputfilepath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		for (const std::string& answer : answers) {
+			out << answer << '\n';
+		}
+		out.close();
+		if (!out) {
+			std::cout << "Fatal error: cannot write output file \"" << outputfilepath << "\"." << std::endl;
+			return 0;
+		}
+
+		std::cout << std::endl;
+		std::cout << "Answered " << lines.size() << " queries in " << microseconds_elapsed / 1000 << " ms";
+		if (microseconds_elapsed > 0)std::cout << " (" << static_cast<unsigned long long>(lines.size() * 1000000.0 / microseconds_elapsed) << " queries per second)";
+		std::cout << "." << std::endl;
+		if (!lines.empty()) {
+			// latency percentiles by the nearest-rank method
+			std::sort(latencies.begin(), latencies.end());
+			auto percentile = [&latencies](unsigned p) {
+				const std::size_t rank = (latencies.size() * p + 99) / 100;
+				return std::chrono::duration_cast<std::chrono::microseconds>(latencies[rank == 0 ? 0 : rank - 1]).count();
+			};
+			std::cout << "Query latency: p50 " << percentile(50) << " us, p90 " << percentile(90) << " us, p99 " << percentile(99) << " us, max " << percentile(100) << " us." << std::endl;
+		}
+		return 0;
+	}
+
+
+	std::string required_mods_str;
+	if (!read_required_param(argc, argv, "--required", "Fatal error: required modules not specified.  Use \"--required=<module code 1>,<module code 2>,...\", e.g. \"--required=CS1010,MA1101R,CS1231,BN1101,GET1002\" (without spaces).", required_mods_str))return 0;
+
+	std::string fixed_mods_str;
+	read_optional_param(argc, argv, "--fixed", fixed_mods_str);
+	for (char& ch : fixed_mods_str) {
+		if (ch == '-' || ch == '_')ch = ' ';
+	}
+
+
 	autotimetable::score_config scorer = autotimetable::default_config();
 	{
 		std::string override_empty_slot_penalty;
@@ -348,6 +602,81 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	std::size_t top_count = 1;
+	{
+		std::string override_top_count;
+		if (read_optional_param(argc, argv, "--top", override_top_count)) {
+			try {
+				top_count = static_cast<std::size_t>(std::stoul(override_top_count));
+				if (top_count == 0) {
+					std::cout << "Warning: --top must be at least 1, ignoring it." << std::endl;
+					top_count = 1;
+				}
+			}
+			catch (...) {
+				std::cout << "Warning: Cannot interpret value for --top, ignoring it." << std::endl;
+			}
+		}
+	}
+
+	autotimetable::search_config search_config = autotimetable::default_search_config();
+	search_config.transposition_table_size = transposition_table_size;
+	{
+		std::string override_thread_count;
+		if (read_optional_param(argc, argv, "--threads", override_thread_count)) {
+			try {
+				search_config.thread_count = static_cast<unsigned>(std::stoul(override_thread_count));
+			}
+			catch (...) {
+				std::cout << "Warning: Cannot interpret value for --threads, ignoring it." << std::endl;
+			}
+		}
+	}
+
+	{
+		std::string propagate_str;
+		if (read_optional_param(argc, argv, "--propagate", propagate_str)) {
+			if (propagate_str.empty() || propagate_str == "true" || propagate_str == "t" || propagate_str == "1") {
+				search_config.propagate = true;
+			}
+			else if (propagate_str == "false" || propagate_str == "f" || propagate_str == "0") {
+				search_config.propagate = false;
+			}
+			else {
+				std::cout << "Warning: Cannot interpret value for --propagate, ignoring it." << std::endl;
+			}
+		}
+	}
+
+	{
+		std::string order_str;
+		if (read_optional_param(argc, argv, "--choice-order", order_str)) {
+			if (order_str == "cheapest") {
+				search_config.order = autotimetable::choice_order::cheapest_first;
+			}
+			else if (order_str == "stored") {
+				search_config.order = autotimetable::choice_order::stored;
+			}
+			else {
+				std::cout << "Warning: Cannot interpret value for --choice-order, ignoring it." << std::endl;
+			}
+		}
+	}
+
+	bool has_time_limit = false;
+	std::chrono::milliseconds time_limit(0);
+	{
+		std::string override_time_limit;
+		if (read_optional_param(argc, argv, "--time-limit", override_time_limit)) {
+			try {
+				time_limit = std::chrono::milliseconds(static_cast<std::chrono::milliseconds::rep>(std::min<unsigned long long>(std::stoull(override_time_limit), std::numeric_limits<std::chrono::milliseconds::rep>::max())));
+				has_time_limit = true;
+			}
+			catch (...) {
+				std::cout << "Warning: Cannot interpret value for --time-limit, ignoring it." << std::endl;
+			}
+		}
+	}
 
 
 
@@ -368,18 +697,18 @@ int main(int argc, char *argv[]) {
 	}
 
 
-	std::vector<std::tuple<std::string, std::string, std::string>> fixed_mods;
+	std::vector<query::fixed_choice> fixed_mods;
 	if (!fixed_mods_str.empty()) {
 		std::size_t curr = 0;
 		while (true) {
 			std::size_t next = fixed_mods_str.find(',', curr);
 			try {
 				if (next == std::string::npos) {
-					fixed_mods.emplace_back(parse_fixed_mod(fixed_mods_str, curr, fixed_mods_str.size()));
+					fixed_mods.emplace_back(query::parse_fixed_mod(fixed_mods_str, curr, fixed_mods_str.size()));
 					break;
 				}
 				else {
-					fixed_mods.emplace_back(parse_fixed_mod(fixed_mods_str, curr, next));
+					fixed_mods.emplace_back(query::parse_fixed_mod(fixed_mods_str, curr, next));
 				}
 			}
 			catch (std::invalid_argument& e) {
@@ -398,170 +727,170 @@ int main(int argc, char *argv[]) {
 
 	std::vector<autotimetable::mod> all_mods;
 
-	std::map<std::string, std::vector<autotimetable::mod>::const_iterator> mod_index;
-
 	std::cout << "Loading modules..." << std::endl;
-	{
-		nlohmann::json json_data;
-		try{
-			std::ifstream in(modulefilepath);
-			in >> json_data;
+	if (use_catalog) {
+		// the catalog is mapped into memory and only the required modules are looked up in it
+		try {
+			const catalog::mapped_catalog mapped(catalogfilepath);
+			for (const std::string& mod_title : required_mods) {
+				autotimetable::mod mod;
+				if (std::none_of(all_mods.cbegin(), all_mods.cend(), [&mod_title](const autotimetable::mod& mod) { return mod.code == mod_title; }) && mapped.find(mod_title, mod)) {
+					all_mods.emplace_back(std::move(mod));
+				}
+			}
 		}
-		catch (std::ios_base::failure& e) {
-			std::cout << "Fatal error: " << e.what() << std::endl;
+		catch (const std::runtime_error& err) {
+			std::cout << "Fatal error: " << err.what() << std::endl;
+			return 0;
+		}
+	}
+	else {
+		std::ifstream in(modulefilepath, std::ios_base::in | std::ios_base::binary);
+		if (!in) {
+			std::cout << "Fatal error: cannot open module file \"" << modulefilepath << "\"." << std::endl;
+			return 0;
+		}
+		// only the required modules are built; the rest of the file is skipped
+		try {
+			all_mods = module_loader::load_modules(in, [&required_mods](const std::string& code) {
+				return std::find(required_mods.cbegin(), required_mods.cend(), code) != required_mods.cend();
+			}, [quiet](const std::string& warning) {
+				if (!quiet)std::cout << warning << std::endl;
+			});
+		}
+		catch (const std::invalid_argument& err) {
+			std::cout << "Fatal error: " << err.what() << std::endl;
 			return 0;
 		}
-		std::for_each(std::make_move_iterator(json_data.begin()), std::make_move_iterator(json_data.end()), [&all_mods, quiet](nlohmann::json&& json_module) {
-			autotimetable::mod mod;
-			try {
-				mod.code = json_module["ModuleCode"].get<std::string>();
-				std::map<std::string, std::map<std::string, autotimetable::mod_item_choice>> choices; // {kind, collection of {choicename, choice}}
-				nlohmann::json& json_timeoptions = json_module["Timetable"];
-				std::for_each(std::make_move_iterator(json_timeoptions.begin()), std::make_move_iterator(json_timeoptions.end()), [&choices, quiet, &mod_code = mod.code](nlohmann::json&& json_choice) {
-					std::string kind = json_choice["LessonType"].get<std::string>();
-					std::map<std::string, autotimetable::mod_item_choice>& mod_item_choices = choices.emplace(std::move(kind), std::map<std::string, autotimetable::mod_item_choice>{}).first->second;
-					std::string choice_name = json_choice["ClassNo"].get<std::string>();
-					autotimetable::mod_item_choice& choice = mod_item_choices.emplace(choice_name, autotimetable::mod_item_choice{ choice_name }).first->second;
-					choice.timeblock.add(get_timeblock_from_json_choice(json_choice, [quiet, &mod_code](const std::string& err) {
-						if (!quiet)std::cout << "Soft warning for module " << mod_code << ": " << err << std::endl;
-					}));
-				});
-				mod.items.reserve(choices.size());
-				std::transform(std::make_move_iterator(choices.begin()), std::make_move_iterator(choices.end()), std::back_inserter(mod.items), [](std::pair<std::string, std::map<std::string, autotimetable::mod_item_choice>>&& choice_kind) {
-					std::vector<autotimetable::mod_item_choice> ret_choices;
-					ret_choices.reserve(choice_kind.second.size());
-					std::transform(std::make_move_iterator(choice_kind.second.begin()), std::make_move_iterator(choice_kind.second.end()), std::back_inserter(ret_choices), [](std::pair<std::string, autotimetable::mod_item_choice>&& choice) {
-						return std::move(choice.second);
-					});
-					return autotimetable::mod_item{ std::move(choice_kind.first), std::move(ret_choices) };
-				});
-			}
-			catch (const std::invalid_argument& err) {
-				if (!quiet)std::cout << "Skipping module " << mod.code << " as we cannot interpret it: " << err.what() << std::endl;
-				return;
-			}
-			all_mods.emplace_back(std::move(mod));
-		});
-		all_mods.shrink_to_fit();
 	}
 	std::cout << "Done loading modules." << std::endl;
 
+	// the search goes through an engine, as in the daemon and batch modes, even though it is only used once
 	std::cout << "Building index..." << std::endl;
-	for (auto it = all_mods.cbegin(); it != all_mods.cend(); ++it) {
-		if (!mod_index.emplace(it->code, it).second) {
-			std::cout << "Duplicate module " << it->code << ", module will be skipped" << std::endl;
+	const autotimetable::engine engine(std::move(all_mods));
+	for (std::size_t i = 0; i < engine.modules().size(); ++i) {
+		if (engine.find(engine.modules()[i].code) != i) {
+			std::cout << "Duplicate module " << engine.modules()[i].code << ", module will be skipped" << std::endl;
 		}
 	}
 	std::cout << "Done building index." << std::endl;
 
-	std::vector<autotimetable::mod> selected_mods;
+	std::vector<std::size_t> module_indices;
+	std::vector<autotimetable::pin> pins;
 
 	std::cout << "Preparing parameters for autotimetable..." << std::endl;
 	for (const std::string& mod_title : required_mods) {
-		auto it = mod_index.find(mod_title);
-		if (it == mod_index.end()) {
+		const std::size_t module_index = engine.find(mod_title);
+		if (module_index == engine.modules().size()) {
 			std::cout << "Cannot find module " << mod_title << " as requested, module will be ignored" << std::endl;
 		}
-		else {
-			selected_mods.emplace_back(*(it->second)); // *copies* the autotimetable::mod
+		else if (std::find(module_indices.cbegin(), module_indices.cend(), module_index) == module_indices.cend()) {
+			module_indices.emplace_back(module_index);
 		}
 	}
-	for (const std::tuple<std::string, std::string, std::string>& fix : fixed_mods) {
-		const std::string& mod_code = std::get<0>(fix);
-		auto it1 = std::find_if(selected_mods.begin(), selected_mods.end(), [&mod_code](const autotimetable::mod& mod){
-			return mod.code == mod_code;
-		});
-		if (it1 == selected_mods.end()) {
-			std::cout << "Cannot find module code \"" << mod_code << "\", fixed module constraint will be ignored" << std::endl;
-		}
-		else {
-			auto& items = it1->items;
-			const std::string& mod_kind = std::get<1>(fix);
-			auto it2 = std::find_if(items.begin(), items.end(), [&mod_kind](const autotimetable::mod_item& item) {
-				return item.kind == mod_kind;
-			});
-			if (it2 == items.end()) {
-				std::cout << "Cannot find module kind \"" << mod_kind << "\", fixed module constraint will be ignored" << std::endl;
-			}
-			else {
-				auto& choices = it2->choices;
-				const std::string& mod_choice = std::get<2>(fix);
-				auto it3 = std::find_if(choices.begin(), choices.end(), [&mod_choice](const autotimetable::mod_item_choice& choice) {
-					return choice.name == mod_choice;
-				});
-				if (it3 == choices.end()) {
-					std::cout << "Cannot find module choice \"" << mod_choice << "\", fixed module constraint will be ignored" << std::endl;
-				}
-				else {
-					// delete all the choices except this one:
-					autotimetable::mod_item_choice choice = std::move(*it3);
-					choices.clear();
-					choices.emplace_back(std::move(choice));
-				}
-			}
+	for (const query::fixed_choice& fix : fixed_mods) {
+		const std::string problem = query::find_pin(engine, module_indices, fix, pins);
+		if (!problem.empty()) {
+			std::cout << problem << ", fixed module constraint will be ignored" << std::endl;
 		}
 	}
 	std::cout << "Done preparing." << std::endl;
 
 	std::cout << "Running autotimetable..." << std::endl;
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+	std::size_t start_allocation_count = allocation_count;
+#endif
 	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
-	autotimetable::timetable find_result = autotimetable::find_best(selected_mods, scorer);
+	if (has_time_limit)search_config.deadline = autotimetable::deadline_after(start_time, time_limit);
+	if (!quiet) {
+		search_config.on_improvement = [start_time](const autotimetable::timetable&, autotimetable::score_t score) {
+			auto milliseconds_found = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+			std::cout << "Found a timetable with penalty " << score << " after " << milliseconds_found << " ms." << std::endl;
+		};
+	}
+	std::vector<autotimetable::timetable> find_results;
+	bool find_optimal = true;
+	autotimetable::score_t find_lower_bound = 0;
+	std::size_t find_node_count = 0;
+	autotimetable::search_stats find_stats;
+	if (top_count == 1) {
+		autotimetable::search_result find_result = engine.solve(module_indices, pins, scorer, search_config);
+		find_optimal = find_result.optimal;
+		find_lower_bound = find_result.lower_bound;
+		find_node_count = find_result.node_count;
+		find_stats = std::move(find_result.stats);
+		if (!quiet && find_result.dominated_choice_count != 0) {
+			std::cout << "Skipped " << find_result.dominated_choice_count << " choices that take up more slots than another choice of the same lesson." << std::endl;
+		}
+		if (!quiet && find_result.component_count > 1) {
+			std::cout << "Searched " << find_result.component_count << " groups of lessons with no day in common separately." << std::endl;
+		}
+		if (!find_result.best_timetable.items.empty())find_results.emplace_back(std::move(find_result.best_timetable));
+	}
+	else {
+		autotimetable::top_k_result find_result = engine.solve_top_k(module_indices, pins, top_count, scorer, search_config);
+		find_optimal = find_result.optimal;
+		find_lower_bound = find_result.lower_bound;
+		find_node_count = find_result.node_count;
+		find_stats = std::move(find_result.stats);
+		find_results = std::move(find_result.timetables);
+	}
 	auto milliseconds_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+	std::size_t allocations_made = allocation_count - start_allocation_count;
+#endif
 	std::cout << "Done running autotimetable..." << std::endl;
 
 	std::cout << std::endl;
 
-	// find the first and last hours to print
-	unsigned begin_index = std::accumulate(find_result.items.cbegin(), find_result.items.cend(), 24u, [](unsigned prev, const std::tuple<typename std::vector<autotimetable::mod>::const_iterator, typename std::vector<autotimetable::mod_item>::const_iterator, typename std::vector<autotimetable::mod_item_choice>::const_iterator>& curr) {
-		return std::min(prev, std::accumulate(std::get<2>(curr)->timeblock.days, std::get<2>(curr)->timeblock.days + autotimetable::TIMEBLOCK_DAY_COUNT, 24u, [](unsigned prev, const autotimetable::timeblock_day_t& curr) {
-			if (curr == 0)return prev;
-			return std::min(prev, intrinsics::find_smallest_set(curr));
-		}));
-	});
-	unsigned end_index = std::accumulate(find_result.items.cbegin(), find_result.items.cend(), 0u, [](unsigned prev, const std::tuple<typename std::vector<autotimetable::mod>::const_iterator, typename std::vector<autotimetable::mod_item>::const_iterator, typename std::vector<autotimetable::mod_item_choice>::const_iterator>& curr) {
-		return std::max(prev, std::accumulate(std::get<2>(curr)->timeblock.days, std::get<2>(curr)->timeblock.days + autotimetable::TIMEBLOCK_DAY_COUNT, 0u, [](unsigned prev, const autotimetable::timeblock_day_t& curr) {
-			if (curr == 0)return prev;
-			return std::max(prev, intrinsics::find_largest_set(curr));
-		}));
-	}) + 1;
-
-	if (begin_index >= end_index) {
-		std::cout << "No suitable timetable found." << std::endl;
+	if (top_count == 1) {
+		if (find_results.empty()) {
+			std::cout << "No suitable timetable found." << std::endl;
+		}
+		else {
+			std::cout << "Here is the result:" << std::endl;
+			std::cout << std::endl;
+			print_timetable(std::cout, find_results.front());
+		}
 	}
 	else {
-
-		// print the result nicely
-		std::cout << "Here is the result:" << std::endl;
-		std::cout << std::endl;
-		std::cout << "=== Odd Week ===" << std::endl;
-		print_spacer(std::cout, begin_index, end_index, 8);
-		print_header(std::cout, begin_index, end_index, 8);
-		print_spacer(std::cout, begin_index, end_index, 8);
-		for (unsigned i = 0; i < 6; ++i) {
-			if (i % 6 != 5 || find_result.timeblock.days[i] != 0) {
-				print_modname(std::cout, begin_index, end_index, 8, find_result, i);
-				print_modkind(std::cout, begin_index, end_index, 8, find_result, i);
-				print_modchoice(std::cout, begin_index, end_index, 8, find_result, i);
-				print_spacer(std::cout, begin_index, end_index, 8);
-			}
+		if (find_results.empty()) {
+			std::cout << "No suitable timetable found." << std::endl;
 		}
-		std::cout << std::endl;
-		std::cout << "=== Even Week ===" << std::endl;
-		print_spacer(std::cout, begin_index, end_index, 8);
-		print_header(std::cout, begin_index, end_index, 8);
-		print_spacer(std::cout, begin_index, end_index, 8);
-		for (unsigned i = 6; i < 12; ++i) {
-			if (i % 6 != 5 || find_result.timeblock.days[i] != 0) {
-				print_modname(std::cout, begin_index, end_index, 8, find_result, i);
-				print_modkind(std::cout, begin_index, end_index, 8, find_result, i);
-				print_modchoice(std::cout, begin_index, end_index, 8, find_result, i);
-				print_spacer(std::cout, begin_index, end_index, 8);
+		else {
+			std::cout << "Here are the " << find_results.size() << " best results:" << std::endl;
+			for (std::size_t i = 0; i < find_results.size(); ++i) {
+				std::cout << std::endl;
+				std::cout << "##### Result " << (i + 1) << " (penalty " << autotimetable::calculate_score(find_results[i].timeblock, scorer) << ") #####" << std::endl;
+				std::cout << std::endl;
+				print_timetable(std::cout, find_results[i]);
 			}
 		}
-		
 	}
 	std::cout << std::endl;
 	std::cout << "Autotimetable executed in " << milliseconds_elapsed << " ms." << std::endl;
+	if (!quiet) {
+		std::cout << "Autotimetable searched " << find_node_count << " nodes." << std::endl;
+	}
+	if (!find_optimal) {
+		std::cout << "The time limit was reached before the search finished, so there may be a better timetable." << std::endl;
+		if (top_count == 1 && !find_results.empty()) {
+			std::cout << "No timetable has a penalty less than " << find_lower_bound << "." << std::endl;
+		}
+		else if (top_count > 1 && !find_results.empty()) {
+			std::cout << "No other timetable has a penalty less than " << find_lower_bound << "." << std::endl;
+		}
+	}
+#ifdef AUTOTIMETABLE_COUNT_ALLOCATIONS
+	std::cout << "Autotimetable made " << allocations_made << " heap allocations, " << find_stats.search_allocations << " of them in the search loop." << std::endl;
+	if (find_stats.search_allocations != 0) {
+		std::cout << "Error: the search loop is not allocation-free." << std::endl;
+		return 1;
+	}
+#endif
+#ifdef AUTOTIMETABLE_STATS
+	std::cout << "Search statistics: " << autotimetable::to_json(find_stats) << std::endl;
+#endif
 
 	return 0;
 }
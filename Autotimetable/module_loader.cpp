@@ -0,0 +1,387 @@
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+#include <istream>
+#include <functional>
+#include <stdexcept>
+
+#include "module_loader.hpp"
+
+namespace module_loader {
+
+	inline unsigned int parse_day(const std::string& daytext) {
+		if (daytext == "Monday")return 0;
+		if (daytext == "Tuesday")return 1;
+		if (daytext == "Wednesday")return 2;
+		if (daytext == "Thursday")return 3;
+		if (daytext == "Friday")return 4;
+		if (daytext == "Saturday")return 5;
+		throw std::invalid_argument("Argument \"" + daytext + "\" not interpretable as day of week.");
+	}
+
+	enum : unsigned int {
+		WEEK_ODD = 1, WEEK_EVEN = 2
+	};
+
+	inline unsigned int parse_weektype_lenient(const std::string& weektext, std::string& error) noexcept {
+		if (weektext == "Odd Week")return WEEK_ODD;
+		if (weektext == "Even Week")return WEEK_EVEN;
+		if (weektext == "Every Week")return WEEK_ODD | WEEK_EVEN;
+		if (weektext == "0,1,2,3,4,5,6,7,8,9,10,11,12,13")return WEEK_ODD | WEEK_EVEN;
+		error = "Argument \"" + weektext + "\" not interpretable as week type, will be treated as a weekly lesson.";
+		return WEEK_ODD | WEEK_EVEN; // if we can't tell, just say its every week for good measure
+	}
+
+
+	// the fields of a lesson that we need, as they appear in the file
+	struct json_lesson {
+		enum : unsigned int {
+			LESSON_TYPE, CLASS_NO, WEEK_TEXT, DAY_TEXT, START_TIME, END_TIME, FIELD_COUNT
+		};
+		std::string fields[FIELD_COUNT];
+		bool present[FIELD_COUNT] = {};
+
+		// the index of the field with the given key, or FIELD_COUNT if we don't need it
+		static inline unsigned int field_index(const std::string& key) noexcept {
+			if (key == "LessonType")return LESSON_TYPE;
+			if (key == "ClassNo")return CLASS_NO;
+			if (key == "WeekText")return WEEK_TEXT;
+			if (key == "DayText")return DAY_TEXT;
+			if (key == "StartTime")return START_TIME;
+			if (key == "EndTime")return END_TIME;
+			return FIELD_COUNT;
+		}
+
+		inline const std::string& get(const unsigned int index) const {
+			static const char* const names[FIELD_COUNT] = { "LessonType", "ClassNo", "WeekText", "DayText", "StartTime", "EndTime" };
+			if (!present[index])throw std::invalid_argument(std::string("Lesson has no ") + names[index] + " text.");
+			return fields[index];
+		}
+	};
+
+	template <typename Callback>
+	inline autotimetable::timeblock get_timeblock_from_json_lesson(const json_lesson& lesson, Callback soft_error_callback) {
+		autotimetable::timeblock ret;
+
+		const std::string& weektext = lesson.get(json_lesson::WEEK_TEXT);
+		const std::string& daytext = lesson.get(json_lesson::DAY_TEXT);
+		const std::string& starttimetext = lesson.get(json_lesson::START_TIME);
+		const std::string& endtimetext = lesson.get(json_lesson::END_TIME);
+
+		std::string weekerr;
+		unsigned int weekmask = parse_weektype_lenient(weektext, weekerr);
+		if (!weekerr.empty())soft_error_callback(weekerr);
+		unsigned int daynum = parse_day(daytext);
+		unsigned int starttime = static_cast<unsigned int>(std::stoul(starttimetext)) / 100;
+		unsigned int endtime = (static_cast<unsigned int>(std::stoul(endtimetext)) + 99) / 100; // round times up to nearest hour
+		if (daynum >= (autotimetable::TIMEBLOCK_DAY_COUNT >> 1))throw std::invalid_argument("Day of week not valid.");
+		if (starttime >= endtime)throw std::invalid_argument("Time range not valid.");
+
+		autotimetable::timeblock_day_t dayres = 0;
+		for (unsigned int i = starttime; i < endtime; ++i) {
+			dayres |= (1u << i);
+		}
+
+		if (weekmask & WEEK_ODD)ret.days[daynum] = dayres;
+		if (weekmask & WEEK_EVEN)ret.days[(autotimetable::TIMEBLOCK_DAY_COUNT >> 1) + daynum] = dayres;
+
+		return ret;
+	}
+
+
+	// a pull parser for JSON that reads its input one chunk at a time
+	// the caller walks through the document with expect/consume/read_string, and calls skip_value on anything it doesn't need, which is scanned without being stored
+	// (a skipped value is only checked for matching brackets and strings, not for being valid JSON in every detail)
+	class json_reader {
+	public:
+		explicit json_reader(std::istream& in) : in(in), buffer(1 << 16), pos(0), len(0), offset(0) {}
+
+		// the next character that is not whitespace, without consuming it ('\0' at the end of the input)
+		inline char peek() {
+			while (true) {
+				if (pos == len && !refill())return '\0';
+				const char ch = buffer[pos];
+				if (ch != ' ' && ch != '\t' && ch != '\n' && ch != '\r')return ch;
+				++pos;
+			}
+		}
+
+		// consumes the next character that is not whitespace if it is ch, and returns whether it was
+		inline bool consume(const char ch) {
+			if (peek() != ch)return false;
+			++pos;
+			return true;
+		}
+
+		inline void expect(const char ch) {
+			if (!consume(ch))fail(std::string("'") + ch + "' expected");
+		}
+
+		// reads a string value, decoding its escapes
+		inline std::string read_string() {
+			std::string ret;
+			expect('"');
+			while (true) {
+				if (pos == len && !refill())fail("unterminated string");
+				// copy the plain characters up to the next quote or backslash in one go
+				const std::size_t start = pos;
+				while (pos < len && buffer[pos] != '"' && buffer[pos] != '\\') {
+					if (static_cast<unsigned char>(buffer[pos]) < 0x20)fail("control character in string");
+					++pos;
+				}
+				ret.append(buffer.data() + start, pos - start);
+				if (pos == len)continue;
+				if (buffer[pos++] == '"')return ret;
+				read_escape(ret);
+			}
+		}
+
+		// skips the next value (of any type) without storing it
+		inline void skip_value() {
+			const char ch = peek();
+			if (ch == '"') {
+				skip_string();
+			}
+			else if (ch == '{' || ch == '[') {
+				std::size_t depth = 0;
+				do {
+					if (pos == len && !refill())fail("unterminated object or array");
+					const char curr = buffer[pos];
+					if (curr == '"') {
+						skip_string();
+						continue;
+					}
+					if (curr == '{' || curr == '[')++depth;
+					else if (curr == '}' || curr == ']')--depth;
+					++pos;
+				} while (depth != 0);
+			}
+			else {
+				// a number, true, false or null
+				std::size_t count = 0;
+				while ((pos < len || refill()) && is_literal_char(buffer[pos])) {
+					++pos;
+					++count;
+				}
+				if (count == 0)fail("value expected");
+			}
+		}
+
+		[[noreturn]] inline void fail(const std::string& what) const {
+			throw std::invalid_argument("Invalid JSON at byte " + std::to_string(offset + pos) + ": " + what + ".");
+		}
+
+	private:
+		std::istream& in;
+		std::vector<char> buffer;
+		std::size_t pos; // the position of the next character in buffer
+		std::size_t len; // the number of characters in buffer
+		std::size_t offset; // the position in the input of buffer[0]
+
+		// reads the next chunk of the input, and returns false if there is none
+		inline bool refill() {
+			offset += len;
+			pos = 0;
+			in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+			len = static_cast<std::size_t>(in.gcount());
+			return len != 0;
+		}
+
+		inline char get() {
+			if (pos == len && !refill())fail("unexpected end of input");
+			return buffer[pos++];
+		}
+
+		static inline bool is_literal_char(const char ch) noexcept {
+			return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '-' || ch == '+' || ch == '.';
+		}
+
+		inline void skip_string() {
+			++pos; // the opening quote
+			while (true) {
+				if (pos == len && !refill())fail("unterminated string");
+				const char ch = buffer[pos++];
+				if (ch == '"')return;
+				if (ch == '\\')get();
+			}
+		}
+
+		inline unsigned int read_hex4() {
+			unsigned int ret = 0;
+			for (int i = 0; i < 4; ++i) {
+				const char ch = get();
+				ret <<= 4;
+				if (ch >= '0' && ch <= '9')ret |= static_cast<unsigned int>(ch - '0');
+				else if (ch >= 'a' && ch <= 'f')ret |= static_cast<unsigned int>(ch - 'a' + 10);
+				else if (ch >= 'A' && ch <= 'F')ret |= static_cast<unsigned int>(ch - 'A' + 10);
+				else fail("invalid \\u escape");
+			}
+			return ret;
+		}
+
+		// decodes the escape after a backslash, appending it to out
+		inline void read_escape(std::string& out) {
+			const char ch = get();
+			switch (ch) {
+			case '"': case '\\': case '/': out += ch; return;
+			case 'b': out += '\b'; return;
+			case 'f': out += '\f'; return;
+			case 'n': out += '\n'; return;
+			case 'r': out += '\r'; return;
+			case 't': out += '\t'; return;
+			case 'u': break;
+			default: fail("invalid escape");
+			}
+			std::uint32_t codepoint = read_hex4();
+			if (codepoint >= 0xD800 && codepoint < 0xDC00) {
+				// a surrogate pair
+				if (get() != '\\' || get() != 'u')fail("unpaired surrogate");
+				const std::uint32_t low = read_hex4();
+				if (low < 0xDC00 || low >= 0xE000)fail("unpaired surrogate");
+				codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+			}
+			// encode as utf-8
+			if (codepoint < 0x80) {
+				out += static_cast<char>(codepoint);
+			}
+			else if (codepoint < 0x800) {
+				out += static_cast<char>(0xC0 | (codepoint >> 6));
+				out += static_cast<char>(0x80 | (codepoint & 0x3F));
+			}
+			else if (codepoint < 0x10000) {
+				out += static_cast<char>(0xE0 | (codepoint >> 12));
+				out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+				out += static_cast<char>(0x80 | (codepoint & 0x3F));
+			}
+			else {
+				out += static_cast<char>(0xF0 | (codepoint >> 18));
+				out += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+				out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+				out += static_cast<char>(0x80 | (codepoint & 0x3F));
+			}
+		}
+	};
+
+
+	// reads the lessons of a module (the "Timetable" array), keeping only the fields we need
+	inline void read_lessons(json_reader& reader, std::vector<json_lesson>& lessons) {
+		if (reader.peek() != '[') {
+			// not a list of lessons, so the module has no lessons
+			reader.skip_value();
+			return;
+		}
+		reader.expect('[');
+		if (reader.consume(']'))return;
+		do {
+			lessons.emplace_back();
+			json_lesson& lesson = lessons.back();
+			if (reader.peek() != '{') {
+				// not a lesson; it will be reported as having no fields
+				reader.skip_value();
+				continue;
+			}
+			reader.expect('{');
+			if (reader.consume('}'))continue;
+			do {
+				const unsigned int index = json_lesson::field_index(reader.read_string());
+				reader.expect(':');
+				if (index != json_lesson::FIELD_COUNT && reader.peek() == '"') {
+					lesson.fields[index] = reader.read_string();
+					lesson.present[index] = true;
+				}
+				else {
+					reader.skip_value();
+				}
+			} while (reader.consume(','));
+			reader.expect('}');
+		} while (reader.consume(','));
+		reader.expect(']');
+	}
+
+	// makes the module with the given lessons, grouping them into items by lesson type, and into choices by class number
+	// throws std::invalid_argument if some lesson cannot be interpreted
+	inline autotimetable::mod make_mod(const std::string& code, const std::vector<json_lesson>& lessons, const std::function<void(const std::string&)>& warn) {
+		autotimetable::mod mod;
+		mod.code = code;
+		std::map<std::string, std::map<std::string, autotimetable::mod_item_choice>> choices; // {kind, collection of {choicename, choice}}
+		for (const json_lesson& lesson : lessons) {
+			const std::string& kind = lesson.get(json_lesson::LESSON_TYPE);
+			std::map<std::string, autotimetable::mod_item_choice>& mod_item_choices = choices.emplace(kind, std::map<std::string, autotimetable::mod_item_choice>{}).first->second;
+			const std::string& choice_name = lesson.get(json_lesson::CLASS_NO);
+			autotimetable::mod_item_choice& choice = mod_item_choices.emplace(choice_name, autotimetable::mod_item_choice{ choice_name, autotimetable::timeblock() }).first->second;
+			choice.timeblock.add(get_timeblock_from_json_lesson(lesson, [&warn, &mod_code = mod.code](const std::string& err) {
+				warn("Soft warning for module " + mod_code + ": " + err);
+			}));
+		}
+		mod.items.reserve(choices.size());
+		std::transform(std::make_move_iterator(choices.begin()), std::make_move_iterator(choices.end()), std::back_inserter(mod.items), [](std::pair<std::string, std::map<std::string, autotimetable::mod_item_choice>>&& choice_kind) {
+			std::vector<autotimetable::mod_item_choice> ret_choices;
+			ret_choices.reserve(choice_kind.second.size());
+			std::transform(std::make_move_iterator(choice_kind.second.begin()), std::make_move_iterator(choice_kind.second.end()), std::back_inserter(ret_choices), [](std::pair<std::string, autotimetable::mod_item_choice>&& choice) {
+				return std::move(choice.second);
+			});
+			return autotimetable::mod_item{ std::move(choice_kind.first), std::move(ret_choices) };
+		});
+		return mod;
+	}
+
+	// reads one module, and adds it to mods if filter accepts it
+	// once the module code has been read, the rest of a module that is not accepted is skipped (in NUSMods data, the code comes first)
+	inline void read_module(json_reader& reader, const std::function<bool(const std::string&)>& filter, const std::function<void(const std::string&)>& warn, std::vector<autotimetable::mod>& mods) {
+		std::string code;
+		bool has_code = false;
+		bool wanted = true; // until we know the code, we have to keep the lessons in case the module is wanted
+		std::vector<json_lesson> lessons;
+		reader.expect('{');
+		if (!reader.consume('}')) {
+			do {
+				const std::string key = reader.read_string();
+				reader.expect(':');
+				if (key == "ModuleCode" && !has_code && reader.peek() == '"') {
+					code = reader.read_string();
+					has_code = true;
+					wanted = filter(code);
+				}
+				else if (key == "Timetable" && wanted) {
+					read_lessons(reader, lessons);
+				}
+				else {
+					reader.skip_value();
+				}
+			} while (reader.consume(','));
+			reader.expect('}');
+		}
+
+		// a module without a code cannot be asked for
+		if (!has_code || !wanted)return;
+
+		try {
+			mods.emplace_back(make_mod(code, lessons, warn));
+		}
+		catch (const std::invalid_argument& err) {
+			warn("Skipping module " + code + " as we cannot interpret it: " + err.what());
+		}
+	}
+
+	std::vector<autotimetable::mod> load_modules(std::istream& in, const std::function<bool(const std::string&)>& filter, const std::function<void(const std::string&)>& warn) {
+		json_reader reader(in);
+		std::vector<autotimetable::mod> ret;
+		reader.expect('[');
+		if (!reader.consume(']')) {
+			do {
+				if (reader.peek() != '{')reader.fail("module expected");
+				read_module(reader, filter, warn, ret);
+			} while (reader.consume(','));
+			reader.expect(']');
+		}
+		if (reader.peek() != '\0')reader.fail("unexpected data after the modules");
+		ret.shrink_to_fit();
+		return ret;
+	}
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <functional>
+
+#include "autotimetable.hpp"
+
+namespace module_loader {
+
+	// reads module data in NUSMods format (a JSON array of modules) in a single pass, in chunks, without building the JSON document in memory
+	// only the modules whose code is accepted by filter are built; the rest of every other module is skipped without being interpreted
+	// warn is called with a message for every accepted module that has lessons that cannot be interpreted (the module is left out if the lesson is unusable)
+	// throws std::invalid_argument if the input is not valid JSON, or is not an array of objects
+	std::vector<autotimetable::mod> load_modules(std::istream& in, const std::function<bool(const std::string&)>& filter, const std::function<void(const std::string&)>& warn);
+
+}
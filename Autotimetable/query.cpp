@@ -0,0 +1,230 @@
+#include <cstdint>
+
+#include <limits>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "json.hpp"
+
+#include "query.hpp"
+
+namespace query {
+
+	fixed_choice parse_fixed_mod(const std::string& fixed_mods_str, std::size_t begin, std::size_t end) {
+		std::size_t c1 = fixed_mods_str.find(':', begin);
+		if (c1 == std::string::npos) {
+			throw std::invalid_argument("Cannot parse fixed mod selection: \"" + fixed_mods_str.substr(begin, end - begin) + "\".");
+		}
+		std::size_t c2 = fixed_mods_str.find(':', c1 + 1);
+		if (c2 == std::string::npos) {
+			throw std::invalid_argument("Cannot parse fixed mod selection: \"" + fixed_mods_str.substr(begin, end - begin) + "\".");
+		}
+		std::size_t c3 = fixed_mods_str.find(':', c2 + 1);
+		if (c3 < end) {
+			throw std::invalid_argument("Cannot parse fixed mod selection: \"" + fixed_mods_str.substr(begin, end - begin) + "\".");
+		}
+		return fixed_choice(fixed_mods_str.substr(begin, c1 - begin), fixed_mods_str.substr(c1 + 1, c2 - (c1 + 1)), fixed_mods_str.substr(c2 + 1, end - (c2 + 1)));
+	}
+
+	std::string find_pin(const autotimetable::engine& engine, const std::vector<std::size_t>& module_indices, const fixed_choice& fix, std::vector<autotimetable::pin>& pins) {
+		const std::string& mod_code = std::get<0>(fix);
+		const std::size_t module_index = engine.find(mod_code);
+		if (std::find(module_indices.cbegin(), module_indices.cend(), module_index) == module_indices.cend()) {
+			return "Cannot find module code \"" + mod_code + "\"";
+		}
+		const std::vector<autotimetable::mod_item>& items = engine.modules()[module_index].items;
+		const std::string& mod_kind = std::get<1>(fix);
+		auto it2 = std::find_if(items.cbegin(), items.cend(), [&mod_kind](const autotimetable::mod_item& item) {
+			return item.kind == mod_kind;
+		});
+		if (it2 == items.cend()) {
+			return "Cannot find module kind \"" + mod_kind + "\"";
+		}
+		const std::vector<autotimetable::mod_item_choice>& choices = it2->choices;
+		const std::string& mod_choice = std::get<2>(fix);
+		auto it3 = std::find_if(choices.cbegin(), choices.cend(), [&mod_choice](const autotimetable::mod_item_choice& choice) {
+			return choice.name == mod_choice;
+		});
+		const autotimetable::pin new_pin{ module_index, static_cast<std::size_t>(it2 - items.cbegin()), static_cast<std::size_t>(it3 - choices.cbegin()) };
+		// an item that is already fixed has no other choice left to fix (unless it is the same choice)
+		auto it4 = std::find_if(pins.cbegin(), pins.cend(), [&new_pin](const autotimetable::pin& p) {
+			return p.module_index == new_pin.module_index && p.item_index == new_pin.item_index;
+		});
+		if (it3 == choices.cend() || (it4 != pins.cend() && it4->choice_index != new_pin.choice_index)) {
+			return "Cannot find module choice \"" + mod_choice + "\"";
+		}
+		if (it4 == pins.cend())pins.emplace_back(new_pin);
+		return std::string();
+	}
+
+
+	// reads an unsigned integer member of the query, leaving out unchanged if it is not there
+	template <typename T>
+	inline bool read_unsigned(const nlohmann::json& query, const char* key, T& out) {
+		auto it = query.find(key);
+		if (it == query.end())return false;
+		if (!it->is_number_unsigned() || it->get<std::uint64_t>() > static_cast<std::uint64_t>(std::numeric_limits<T>::max())) {
+			throw std::invalid_argument(std::string("Cannot interpret value for \"") + key + "\".");
+		}
+		out = static_cast<T>(it->get<std::uint64_t>());
+		return true;
+	}
+
+	// reads an array of strings member of the query, leaving out empty if it is not there
+	inline void read_strings(const nlohmann::json& query, const char* key, std::vector<std::string>& out) {
+		auto it = query.find(key);
+		if (it == query.end())return;
+		if (!it->is_array() || std::any_of(it->cbegin(), it->cend(), [](const nlohmann::json& value) { return !value.is_string(); })) {
+			throw std::invalid_argument(std::string("\"") + key + "\" must be an array of strings.");
+		}
+		for (const nlohmann::json& value : *it) {
+			out.emplace_back(value.get<std::string>());
+		}
+	}
+
+	inline nlohmann::json timetable_to_json(const autotimetable::timetable& timetable, const autotimetable::score_config& scorer) {
+		nlohmann::json lessons = nlohmann::json::array();
+		for (const auto& item : timetable.items) {
+			lessons.push_back({ { "module", std::get<0>(item)->code }, { "kind", std::get<1>(item)->kind }, { "choice", std::get<2>(item)->name } });
+		}
+		return { { "penalty", autotimetable::calculate_score(timetable.timeblock, scorer) }, { "lessons", std::move(lessons) } };
+	}
+
+	inline nlohmann::json answer_json(const nlohmann::json& query, const autotimetable::engine& engine, const autotimetable::search_config& base_config, const limits& query_limits) {
+		if (!query.is_object())throw std::invalid_argument("Query must be a JSON object.");
+		nlohmann::json ret = nlohmann::json::object();
+		nlohmann::json warnings = nlohmann::json::array();
+
+		std::vector<std::string> required_mods;
+		read_strings(query, "required", required_mods);
+		std::vector<std::string> fixed_mods_strs;
+		read_strings(query, "fixed", fixed_mods_strs);
+
+		autotimetable::score_config scorer = autotimetable::default_config();
+		read_unsigned(query, "empty_slot", scorer.empty_slot_penalty);
+		read_unsigned(query, "travel", scorer.travel_penalty);
+		read_unsigned(query, "no_lunch", scorer.no_lunch_penalty);
+		{
+			autotimetable::score_t lunch_start = 0, lunch_end = 0;
+			bool has_lunch_start = read_unsigned(query, "lunch_start", lunch_start);
+			bool has_lunch_end = read_unsigned(query, "lunch_end", lunch_end);
+			if (has_lunch_start != has_lunch_end)throw std::invalid_argument("\"lunch_start\" and \"lunch_end\" must be given together.");
+			if (has_lunch_start) {
+				if (lunch_start % 100 || lunch_end % 100)throw std::invalid_argument("\"lunch_start\" and \"lunch_end\" must end with '00'.");
+				if (lunch_start > 2300)throw std::invalid_argument("\"lunch_start\" larger than 2300.");
+				if (lunch_end > 2400)throw std::invalid_argument("\"lunch_end\" larger than 2400.");
+				if (lunch_start >= lunch_end)throw std::invalid_argument("\"lunch_end\" must be later than \"lunch_start\".");
+				scorer.lunch_time = (1u << (lunch_end / 100)) - (1u << (lunch_start / 100));
+			}
+		}
+
+		std::size_t top_count = 1;
+		read_unsigned(query, "top", top_count);
+		if (top_count == 0)throw std::invalid_argument("\"top\" must be at least 1.");
+		if (top_count > query_limits.max_top)throw std::invalid_argument("\"top\" larger than " + std::to_string(query_limits.max_top) + ".");
+
+		autotimetable::search_config search_config = base_config;
+		{
+			auto it = query.find("propagate");
+			if (it != query.end()) {
+				if (!it->is_boolean())throw std::invalid_argument("Cannot interpret value for \"propagate\".");
+				search_config.propagate = it->get<bool>();
+			}
+		}
+		{
+			auto it = query.find("choice_order");
+			if (it != query.end()) {
+				if (*it == "cheapest")search_config.order = autotimetable::choice_order::cheapest_first;
+				else if (*it == "stored")search_config.order = autotimetable::choice_order::stored;
+				else throw std::invalid_argument("Cannot interpret value for \"choice_order\".");
+			}
+		}
+		read_unsigned(query, "transposition_table_size", search_config.transposition_table_size);
+		std::chrono::milliseconds::rep time_limit = query_limits.default_time_limit;
+		read_unsigned(query, "time_limit", time_limit);
+		if (time_limit > query_limits.max_time_limit) {
+			time_limit = query_limits.max_time_limit;
+			warnings.push_back("Time limit lowered to " + std::to_string(time_limit) + " ms");
+		}
+
+		// select the modules, and fix the lessons (what can't be done is reported as a warning, as the command line does)
+		std::vector<std::size_t> module_indices;
+		for (const std::string& mod_title : required_mods) {
+			const std::size_t module_index = engine.find(mod_title);
+			if (module_index == engine.modules().size()) {
+				warnings.push_back("Cannot find module " + mod_title + " as requested, module will be ignored");
+			}
+			else if (std::find(module_indices.cbegin(), module_indices.cend(), module_index) == module_indices.cend()) {
+				module_indices.emplace_back(module_index);
+			}
+		}
+		std::vector<autotimetable::pin> pins;
+		for (std::string& fixed_mod_str : fixed_mods_strs) {
+			for (char& ch : fixed_mod_str) {
+				if (ch == '-' || ch == '_')ch = ' ';
+			}
+			try {
+				const std::string problem = find_pin(engine, module_indices, parse_fixed_mod(fixed_mod_str, 0, fixed_mod_str.size()), pins);
+				if (!problem.empty())warnings.push_back(problem + ", fixed module constraint will be ignored");
+			}
+			catch (const std::invalid_argument& err) {
+				warnings.push_back(std::string(err.what()) + "  Selection will be ignored.");
+			}
+		}
+
+		std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+		search_config.deadline = autotimetable::deadline_after(start_time, std::chrono::milliseconds(time_limit));
+		nlohmann::json timetables = nlohmann::json::array();
+		if (top_count == 1) {
+			autotimetable::search_result find_result = engine.solve(module_indices, pins, scorer, search_config);
+			if (!find_result.best_timetable.items.empty())timetables.push_back(timetable_to_json(find_result.best_timetable, scorer));
+			ret["optimal"] = find_result.optimal;
+			ret["lower_bound"] = find_result.lower_bound;
+			ret["node_count"] = find_result.node_count;
+		}
+		else {
+			autotimetable::top_k_result find_result = engine.solve_top_k(module_indices, pins, top_count, scorer, search_config);
+			for (const autotimetable::timetable& timetable : find_result.timetables) {
+				timetables.push_back(timetable_to_json(timetable, scorer));
+			}
+			ret["optimal"] = find_result.optimal;
+			ret["lower_bound"] = find_result.lower_bound;
+			ret["node_count"] = find_result.node_count;
+		}
+		ret["time_us"] = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+		ret["timetables"] = std::move(timetables);
+		ret["warnings"] = std::move(warnings);
+		return ret;
+	}
+
+	std::string answer(const std::string& line, const autotimetable::engine& engine, const autotimetable::search_config& base_config, const limits& query_limits) {
+		if (std::all_of(line.cbegin(), line.cend(), [](const char ch) { return ch == ' ' || ch == '\t'; })) {
+			return nlohmann::json{ { "error", "Query is empty." } }.dump();
+		}
+		nlohmann::json query;
+		try {
+			query = nlohmann::json::parse(line);
+		}
+		catch (const std::exception& err) {
+			return nlohmann::json{ { "error", std::string("Query is not valid JSON: ") + err.what() } }.dump();
+		}
+		nlohmann::json ret;
+		try {
+			ret = answer_json(query, engine, base_config, query_limits);
+		}
+		catch (const std::exception& err) {
+			ret = { { "error", err.what() } };
+		}
+		if (query.is_object()) {
+			auto it = query.find("id");
+			if (it != query.end())ret["id"] = *it;
+		}
+		return ret.dump();
+	}
+
+}
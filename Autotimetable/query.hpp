@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <tuple>
+#include <chrono>
+
+#include "autotimetable.hpp"
+
+namespace query {
+
+	// a lesson to fix, as (module code, item kind, choice name)
+	typedef std::tuple<std::string, std::string, std::string> fixed_choice;
+
+	// parses the selection "<module code>:<item kind>:<choice name>" in fixed_mods_str[begin, end)
+	// throws std::invalid_argument if it is not in that form
+	fixed_choice parse_fixed_mod(const std::string& fixed_mods_str, std::size_t begin, std::size_t end);
+
+	// finds the pin for the fixed choice, amongst the modules of the engine with the given indices, and adds it to pins
+	// returns an empty string if done, otherwise a message saying what cannot be found (and pins is left unchanged)
+	std::string find_pin(const autotimetable::engine& engine, const std::vector<std::size_t>& module_indices, const fixed_choice& fix, std::vector<autotimetable::pin>& pins);
+
+	// what a query may ask for, so that a single query cannot keep a worker busy for long
+	struct limits {
+		std::size_t max_top; // queries with a larger "top" are rejected
+		std::chrono::milliseconds::rep default_time_limit; // the time limit of queries without a "time_limit"
+		std::chrono::milliseconds::rep max_time_limit; // larger time limits (including default_time_limit) are lowered to this
+	};
+
+	inline limits default_limits() noexcept {
+		return limits{ 100, 1000, 10000 };
+	}
+
+	// answers a query given as a JSON object on one line, and returns the answer as a JSON object on one line (without the newline)
+	// the query has the same fields as the command-line options: "required" (an array of module codes), "fixed" (an array of selections written as in --fixed),
+	// "empty_slot", "travel", "no_lunch", "lunch_start", "lunch_end", "top", "time_limit", "transposition_table_size" (unsigned integers), "propagate" (a boolean) and "choice_order" ("cheapest" or "stored"),
+	// and optionally an "id" of any type, which is copied into the answer
+	// the modules are looked up in the engine, and the search is run with base_config, except for what the query overrides (within query_limits)
+	// this does not throw for bad queries; the answer then has an "error" member instead of the timetables
+	std::string answer(const std::string& line, const autotimetable::engine& engine, const autotimetable::search_config& base_config, const limits& query_limits);
+
+}
@@ -0,0 +1,218 @@
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "server.hpp"
+
+namespace server {
+
+#if defined(_WIN32)
+
+	void serve(const std::string&, unsigned, const std::function<std::string(const std::string&)>&) {
+		throw std::runtime_error("Unix domain sockets are not supported on this platform.");
+	}
+
+#else
+
+	// the longest line accepted; a connection that sends a longer one is closed
+	constexpr const std::size_t MAX_LINE_LENGTH = std::size_t{ 1 } << 20;
+
+	// the most lines of a connection waiting to be answered; nothing more is read from a connection while it has this many
+	constexpr const std::size_t MAX_PENDING_LINES = 64;
+
+	// no more lines of a connection are answered while it has at least this many bytes of answers that the other end hasn't read yet
+	constexpr const std::size_t MAX_PENDING_OUTPUT = std::size_t{ 1 } << 20;
+
+	struct connection {
+		int fd; // non-blocking, so that the polling thread never waits on a slow client
+		std::string received; // received data after the last complete line
+		std::deque<std::string> lines; // complete lines waiting to be answered
+		std::string outgoing; // answers not sent yet (only written by the polling thread)
+		bool busy; // whether a worker is answering one of its lines
+		bool closed; // whether the other end has stopped sending (the lines already received are still answered)
+		bool broken; // whether the connection failed, so nothing more is answered or sent
+		explicit connection(int fd) noexcept : fd(fd), busy(false), closed(false), broken(false) {}
+	};
+
+	void serve(const std::string& socket_path, unsigned worker_count, const std::function<std::string(const std::string&)>& answer) {
+		if (worker_count == 0)worker_count = 1;
+
+		sockaddr_un address;
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path))throw std::runtime_error("Socket path \"" + socket_path + "\" is empty or too long.");
+		std::memcpy(address.sun_path, socket_path.data(), socket_path.size());
+
+		const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listen_fd == -1)throw std::runtime_error("Cannot create socket.");
+		unlink(socket_path.c_str());
+		if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1 || listen(listen_fd, SOMAXCONN) == -1) {
+			close(listen_fd);
+			throw std::runtime_error("Cannot listen on socket \"" + socket_path + "\": " + std::strerror(errno) + ".");
+		}
+
+		// the workers write to wake_fds[1] when they are done with a line, so that the polling thread sends the answer and hands out the next line of that connection
+		int wake_fds[2];
+		if (pipe(wake_fds) == -1) {
+			close(listen_fd);
+			throw std::runtime_error("Cannot create pipe.");
+		}
+		fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+		fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+
+		// connections are only erased by the polling thread, and never while a worker is answering one of their lines
+		std::list<connection> connections;
+		std::deque<std::pair<connection*, std::string>> jobs;
+		std::mutex mutex;
+		std::condition_variable job_cv;
+
+		std::vector<std::thread> workers;
+		for (unsigned i = 0; i < worker_count; ++i) {
+			workers.emplace_back([&]() {
+				while (true) {
+					std::unique_lock<std::mutex> lock(mutex);
+					job_cv.wait(lock, [&jobs]() {
+						return !jobs.empty();
+					});
+					connection* conn = jobs.front().first;
+					std::string line = std::move(jobs.front().second);
+					jobs.pop_front();
+					lock.unlock();
+
+					std::string response = answer(line);
+					response.push_back('\n');
+
+					// the answer is sent by the polling thread, so a client that doesn't read its answers can't hold up a worker
+					lock.lock();
+					conn->busy = false;
+					if (!conn->broken)conn->outgoing.append(response);
+					lock.unlock();
+					const char ch = 0;
+					while (write(wake_fds[1], &ch, 1) == -1 && errno == EINTR);
+				}
+			});
+		}
+
+		std::vector<pollfd> poll_fds;
+		std::vector<connection*> poll_connections;
+		std::vector<char> buffer(1 << 16);
+		while (true) {
+			// hand out the next line of every idle connection, and close the idle connections that are done
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (auto it = connections.begin(); it != connections.end(); ) {
+					if (!it->busy && !it->broken && !it->lines.empty() && it->outgoing.size() < MAX_PENDING_OUTPUT) {
+						it->busy = true;
+						jobs.emplace_back(&*it, std::move(it->lines.front()));
+						it->lines.pop_front();
+						job_cv.notify_one();
+					}
+					if (!it->busy && (it->broken || (it->closed && it->lines.empty() && it->outgoing.empty()))) {
+						close(it->fd);
+						it = connections.erase(it);
+					}
+					else {
+						++it;
+					}
+				}
+				poll_fds.assign({ pollfd{ listen_fd, POLLIN, 0 }, pollfd{ wake_fds[0], POLLIN, 0 } });
+				poll_connections.clear();
+				for (connection& conn : connections) {
+					if (conn.broken)continue;
+					short events = 0;
+					if (!conn.closed && conn.lines.size() < MAX_PENDING_LINES)events |= POLLIN;
+					if (!conn.outgoing.empty())events |= POLLOUT;
+					if (events != 0) {
+						poll_fds.emplace_back(pollfd{ conn.fd, events, 0 });
+						poll_connections.emplace_back(&conn);
+					}
+				}
+			}
+
+			if (poll(poll_fds.data(), poll_fds.size(), -1) == -1)continue; // EINTR
+
+			if (poll_fds[1].revents & POLLIN) {
+				while (read(wake_fds[0], buffer.data(), buffer.size()) > 0);
+			}
+			for (std::size_t i = 0; i < poll_connections.size(); ++i) {
+				const pollfd& poll_fd = poll_fds[i + 2];
+				if (poll_fd.revents == 0)continue;
+				connection& conn = *poll_connections[i];
+				std::lock_guard<std::mutex> lock(mutex);
+				if (poll_fd.events & POLLOUT) {
+					// send as much as the socket takes now; the rest is sent when it is writable again
+					const ssize_t sent = send(conn.fd, conn.outgoing.data(), conn.outgoing.size(), MSG_NOSIGNAL);
+					if (sent >= 0) {
+						conn.outgoing.erase(0, static_cast<std::size_t>(sent));
+					}
+					else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+						conn.broken = true;
+					}
+				}
+				if ((poll_fd.events & POLLIN) && !conn.broken) {
+					const ssize_t received = recv(conn.fd, buffer.data(), buffer.size(), 0);
+					if (received < 0) {
+						if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)conn.broken = true;
+					}
+					else if (received == 0) {
+						// the last line doesn't have to end with a newline
+						conn.closed = true;
+						if (!conn.received.empty()) {
+							if (conn.received.back() == '\r')conn.received.pop_back();
+							conn.lines.emplace_back(std::move(conn.received));
+							conn.received.clear();
+						}
+					}
+					else {
+						// split off the complete lines (without a '\r' before the '\n')
+						// blank lines are kept (and answered with an error), so that the n-th answer is always to the n-th line, as in batch mode
+						conn.received.append(buffer.data(), static_cast<std::size_t>(received));
+						std::size_t begin = 0;
+						for (std::size_t end; (end = conn.received.find('\n', begin)) != std::string::npos; begin = end + 1) {
+							std::size_t line_end = end;
+							if (line_end > begin && conn.received[line_end - 1] == '\r')--line_end;
+							conn.lines.emplace_back(conn.received, begin, line_end - begin);
+						}
+						conn.received.erase(0, begin);
+						if (conn.received.size() > MAX_LINE_LENGTH)conn.broken = true;
+					}
+				}
+				if (conn.broken) {
+					conn.closed = true;
+					conn.lines.clear();
+					conn.outgoing.clear();
+				}
+			}
+			if (poll_fds[0].revents & POLLIN) {
+				const int fd = accept(listen_fd, nullptr, nullptr);
+				if (fd != -1) {
+					fcntl(fd, F_SETFL, O_NONBLOCK);
+					std::lock_guard<std::mutex> lock(mutex);
+					connections.emplace_back(fd);
+				}
+			}
+		}
+	}
+
+#endif
+
+}
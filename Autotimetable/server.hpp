@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <functional>
+
+namespace server {
+
+	// listens on a Unix domain socket at socket_path (replacing any socket file already there), and answers every line received on a connection with answer(line) followed by a newline
+	// every line gets an answer, including blank lines and a last line that the other end sends without a newline before it stops sending
+	// the lines of all the connections are answered by worker_count threads, and the lines of one connection are answered one at a time, in order
+	// a client that doesn't read its answers only holds up itself: its lines stop being answered (and then read) once enough of its answers are waiting to be sent
+	// this only returns by throwing std::runtime_error, if the socket cannot be set up (or Unix domain sockets are not supported on this platform)
+	[[noreturn]] void serve(const std::string& socket_path, unsigned worker_count, const std::function<std::string(const std::string&)>& answer);
+
+}